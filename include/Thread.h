@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <string>
+#include <vector>
 
 namespace multi{
 
@@ -300,6 +301,36 @@ namespace multi{
       */
       static void yieldCurrentThread();
 
+      /**
+      * Hints to the processor that the caller is in a spin wait loop.  Issues
+      * a pause instruction where available and does not give up the core.
+      */
+      static void cpuRelax();
+
+      /**
+      * Pins the thread to the given processors.  If the thread is not running
+      * the processors are remembered and applied when it starts.  An empty
+      * list lets the thread run on any processor.  Only supported on Linux.
+      * Should not be called at the same time as start.
+      *
+      * @param cpus processor ids
+      * @return true if the affinity was applied or stored
+      */
+      bool setAffinity(const std::vector<int>& cpus);
+
+      /**
+      * @return the processors set with setAffinity
+      */
+      std::vector<int> affinity()const;
+
+      /**
+      * Pins the calling thread to the given processors.
+      *
+      * @param cpus processor ids.  An empty list allows any processor
+      * @return true on success and false if it failed or is not supported
+      */
+      static bool setCurrentThreadAffinity(const std::vector<int>& cpus);
+
    protected:
       /**
       * This method must be overriden and is the main entry
@@ -330,6 +361,7 @@ namespace multi{
       std::shared_ptr<multi::Barrier> m_pauseBarrier;
       std::condition_variable         m_runningCondition;
       mutable std::mutex              m_runningMutex;
+      std::vector<int>                m_affinity;
 
       /**
       * @see cancel and @see setCancel
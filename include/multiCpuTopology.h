@@ -0,0 +1,77 @@
+#ifndef multiCpuTopology_HEADER
+#define multiCpuTopology_HEADER
+#include <multiConstants.h>
+#include <vector>
+#include <string>
+
+namespace multi{
+
+   /**
+   * CpuTopology describes the online processors and how they are grouped
+   * into NUMA nodes.  On Linux it is read from /sys/devices/system.  If the
+   * information is not available every processor reported by
+   * std::thread::hardware_concurrency is placed on node 0.
+   *
+   * @code
+   * multi::CpuTopology topology;
+   * for(std::size_t idx = 0; idx < topology.numberOfNodes(); ++idx)
+   * {
+   *    const multi::CpuTopology::Node& node = topology.node(idx);
+   *    std::cout << "node " << node.id << " has " << node.cpus.size() << " cpus\n";
+   * }
+   * @endcode
+   */
+   class OSSIM_DLL CpuTopology
+   {
+   public:
+      typedef std::vector<int> CpuList;
+
+      struct Node
+      {
+         int     id;
+         CpuList cpus;
+      };
+
+      /**
+      * Reads the topology of the machine.
+      */
+      CpuTopology();
+
+      /**
+      * @return the online processors ordered by node and then by id
+      */
+      const CpuList& cpus()const{return m_cpus;}
+
+      /**
+      * @return the number of NUMA nodes with at least one online processor
+      */
+      std::size_t numberOfNodes()const{return m_nodes.size();}
+
+      /**
+      * @param idx index in [0, numberOfNodes())
+      * @return the node
+      */
+      const Node& node(std::size_t idx)const{return m_nodes[idx];}
+
+      /**
+      * @param cpu processor id
+      * @return the id of the node the processor belongs to or -1 if it is not
+      *         online
+      */
+      int nodeOfCpu(int cpu)const;
+
+      /**
+      * Parses a Linux cpu list such as "0-3,8,10-11".
+      *
+      * @param cpuList the list to parse
+      * @return the processor ids in the order listed
+      */
+      static CpuList parseCpuList(const std::string& cpuList);
+
+   private:
+      std::vector<Node> m_nodes;
+      CpuList           m_cpus;
+   };
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef multiForkJoin_HEADER
+#define multiForkJoin_HEADER
+#include <multiJobThreadQueue.h>
+#include <multiJobGroup.h>
+#include <memory>
+#include <vector>
+
+namespace multi{
+
+   /**
+   * ForkJoin lets a job spawn child jobs and wait for them without tying up
+   * its thread.  Children go to the local deque of the calling thread when
+   * work stealing is on, otherwise to the queue.  While joining, the calling
+   * thread first runs its own children that nobody has picked up yet, newest
+   * first, and then runs other queued work until every child is done.  A
+   * small pool therefore can not deadlock on recursive jobs.
+   *
+   * ForkJoin can also be used outside a job thread.  The caller then helps
+   * with jobs from the queue.
+   *
+   * @code
+   * class SumJob : public multiJob
+   * {
+   * protected:
+   *    virtual void run()
+   *    {
+   *       if(m_count < 1024) { m_sum = sum(m_first, m_count); return; }
+   *       std::shared_ptr<SumJob> left  = std::make_shared<SumJob>(m_first, m_count/2);
+   *       std::shared_ptr<SumJob> right = std::make_shared<SumJob>(m_first+m_count/2, m_count-m_count/2);
+   *       multi::ForkJoin forkJoin;
+   *       forkJoin.fork(left);
+   *       forkJoin.fork(right);
+   *       forkJoin.join();
+   *       m_sum = left->m_sum + right->m_sum;
+   *    }
+   * };
+   * @endcode
+   */
+   class OSSIM_DLL ForkJoin
+   {
+   public:
+      /**
+      * Uses the queue of the calling job thread.
+      */
+      ForkJoin();
+
+      /**
+      * @param jobQueue the queue children are added to when they can not go
+      *        to the local deque
+      */
+      ForkJoin(std::shared_ptr<multiJobQueue> jobQueue);
+
+      /**
+      * Joins any children that were not joined.  Exceptions are dropped.
+      */
+      ~ForkJoin();
+
+      /**
+      * Starts a child.  Runs it right away on the calling thread if there is
+      * no queue to put it on.
+      *
+      * @param job the child
+      */
+      void fork(std::shared_ptr<multiJob> job);
+
+      /**
+      * Starts a child that runs a callable
+      *
+      * @param f the callable
+      */
+      template<class F>
+      void forkFunction(F&& f)
+      {
+         fork(std::make_shared<multiFunctionJob>(std::forward<F>(f)));
+      }
+
+      /**
+      * Waits for every child forked so far, running work in the meantime.
+      * A child that was canceled before it ran, for example because its
+      * deadline passed, counts as done.  Rethrows the first exception thrown
+      * by a child, otherwise throws multi::JobNotRun if a child was canceled.
+      */
+      void join();
+
+   private:
+      ForkJoin(const ForkJoin&);
+      ForkJoin& operator=(const ForkJoin&);
+
+      /**
+      * Waits for the children without rethrowing
+      */
+      void helpUntilDone();
+
+      /**
+      * @return true once every child finished or was canceled and is not
+      *         running
+      */
+      bool isDone()const;
+
+      /**
+      * Runs one job from the local thread or the queue
+      *
+      * @return true if a job was run
+      */
+      bool runPendingJob();
+
+      multiJobThreadQueue*                   m_threadQueue;
+      std::shared_ptr<multiJobQueue>         m_jobQueue;
+      std::shared_ptr<JobGroup>              m_group;
+      std::vector<std::shared_ptr<multiJob> > m_children;
+   };
+}
+
+#endif
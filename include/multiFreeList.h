@@ -0,0 +1,157 @@
+#ifndef multiFreeList_HEADER
+#define multiFreeList_HEADER
+#include <multiConstants.h>
+#include <mutex>
+#include <memory>
+#include <cstddef>
+
+namespace multi{
+
+   /**
+   * FreeList keeps released memory blocks so they can be handed out again
+   * without going back to the heap.  Blocks are kept per size for a small
+   * number of sizes.  Other sizes go straight to operator new and delete.
+   * Each size keeps at most maxFree blocks, the blocks released past that go
+   * back to the heap so a burst does not pin its peak memory for good.
+   *
+   * FreeList is thread safe.  It is normally used through a
+   * FreeListAllocator.
+   */
+   class OSSIM_DLL FreeList
+   {
+   public:
+      /**
+      * Blocks kept per size unless set otherwise
+      */
+      static const std::size_t DEFAULT_MAX_FREE = 1024;
+
+      /**
+      * @param maxFree the most blocks kept per size
+      */
+      FreeList(std::size_t maxFree=DEFAULT_MAX_FREE);
+
+      /**
+      * Releases every block that is on the list
+      */
+      ~FreeList();
+
+      /**
+      * @param size the number of bytes
+      * @return a block of at least size bytes
+      */
+      void* allocate(std::size_t size);
+
+      /**
+      * @param block the block to release
+      * @param size the size that was passed to allocate
+      */
+      void deallocate(void* block, std::size_t size);
+
+      /**
+      * @return the number of blocks that are waiting to be reused
+      */
+      std::size_t freeCount()const;
+
+      /**
+      * Sets the most blocks kept per size.  Blocks over a lowered limit are
+      * released right away.
+      *
+      * @param maxFree the most blocks kept per size
+      */
+      void setMaxFree(std::size_t maxFree);
+
+      /**
+      * @return the most blocks kept per size
+      */
+      std::size_t maxFree()const;
+
+   private:
+      FreeList(const FreeList&);
+      FreeList& operator=(const FreeList&);
+
+      struct Block
+      {
+         Block* m_next;
+      };
+      struct SizeClass
+      {
+         std::size_t m_size;
+         Block*      m_head;
+         std::size_t m_count;
+      };
+      static const std::size_t MAX_SIZE_CLASSES = 8;
+
+      /**
+      * Must be called with m_mutex held.
+      *
+      * @return the size class for size or nullptr if all are used by other sizes
+      */
+      SizeClass* sizeClass(std::size_t size);
+
+      mutable std::mutex m_mutex;
+      SizeClass          m_sizeClasses[MAX_SIZE_CLASSES];
+      std::size_t        m_sizeClassCount;
+      std::size_t        m_maxFree;
+   };
+
+   /**
+   * Standard allocator that recycles single object allocations through a
+   * shared FreeList.  Copies and rebound copies share the same FreeList so a
+   * container's nodes, or the control block and object made by
+   * std::allocate_shared, are reused once released.  Array allocations go to
+   * the heap.
+   *
+   * @code
+   * std::shared_ptr<multi::FreeList> freeList = std::make_shared<multi::FreeList>();
+   * std::map<int, int, std::less<int>, multi::FreeListAllocator<std::pair<const int, int> > >
+   *    m(std::less<int>(), multi::FreeListAllocator<std::pair<const int, int> >(freeList));
+   * @endcode
+   */
+   template<class T>
+   class FreeListAllocator
+   {
+   public:
+      typedef T value_type;
+      template<class U> struct rebind{typedef FreeListAllocator<U> other;};
+
+      FreeListAllocator()
+      :m_freeList(std::make_shared<FreeList>())
+      {}
+      explicit FreeListAllocator(std::shared_ptr<FreeList> freeList)
+      :m_freeList(freeList)
+      {}
+      template<class U>
+      FreeListAllocator(const FreeListAllocator<U>& src)
+      :m_freeList(src.freeList())
+      {}
+
+      T* allocate(std::size_t n)
+      {
+         if(n == 1) return static_cast<T*>(m_freeList->allocate(sizeof(T)));
+         return static_cast<T*>(::operator new(n*sizeof(T)));
+      }
+      void deallocate(T* p, std::size_t n)
+      {
+         if(n == 1) m_freeList->deallocate(p, sizeof(T));
+         else ::operator delete(p);
+      }
+
+      const std::shared_ptr<FreeList>& freeList()const{return m_freeList;}
+
+   private:
+      std::shared_ptr<FreeList> m_freeList;
+   };
+
+   template<class T, class U>
+   bool operator==(const FreeListAllocator<T>& a, const FreeListAllocator<U>& b)
+   {
+      return a.freeList() == b.freeList();
+   }
+   template<class T, class U>
+   bool operator!=(const FreeListAllocator<T>& a, const FreeListAllocator<U>& b)
+   {
+      return a.freeList() != b.freeList();
+   }
+}
+
+#endif
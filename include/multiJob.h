@@ -8,11 +8,20 @@
 #ifndef multiJob_HEADER
 #define multiJob_HEADER
 #include <multiConstants.h>
+#include <multiJobGroup.h>
 #include <list>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <exception>
+#include <chrono>
 class multiJob;
+class multiJobQueue;
 
 using multiString = std::string;
 
@@ -116,12 +125,20 @@ public:
       multiJob_ALL = (multiJob_READY|multiJob_RUNNING|multiJob_CANCEL|multiJob_FINISHED)
    };
    
-   multiJob() : m_state(multiJob_READY),  m_priority(0.0) {}
+   multiJob() : m_state(multiJob_READY),  m_priority(0.0), m_hasCallback(false), m_hasGroup(false), m_hasDeadline(false), m_hasKeys(false) {}
+
+   /**
+   * Leaves the job's group if the job never completed
+   */
+   virtual ~multiJob();
 
    /**
    * Main entry point to the job.  It will set the state as running and then
    * call the pure virtual method run. Once completed the job is marked finished
-   * only if the job was not canceled.
+   * only if the job was not canceled.  An exception thrown by run is caught
+   * and kept so it does not escape the thread running the job.  @see exception.
+   * A multi::Thread::Interrupt is the exception, it cancels the job and is
+   * rethrown so the thread being canceled can exit.
    *
    * Classes must override the run method.  @see run.
    */
@@ -155,6 +172,7 @@ public:
    */   
    void setPercentComplete(double value)
    {
+      if(!m_hasCallback.load(std::memory_order_acquire)) return;
       std::lock_guard<std::mutex> lock(m_jobMutex);
       if(m_callback)
       {
@@ -163,15 +181,12 @@ public:
    }
 
    /**
-   * sets the priority of the job
+   * sets the priority of the job.  If the job is waiting on a queue that
+   * orders by priority the queue is notified so the job is re-positioned.
    *
    * @param value priority value
    */
-   void setPriority(double value)
-   {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      m_priority = value;
-   }
+   void setPriority(double value);
 
    /*
    * @return the priotiy of the job
@@ -181,6 +196,47 @@ public:
       return m_priority;
    }
 
+   /**
+   * Sets the time by which the job must have started.  A queue drops the job
+   * instead of starting it once the deadline has passed, and a queue in
+   * DEADLINE_ORDERING dispatches the earliest deadline first.  If the job is
+   * waiting on such a queue it is re-positioned.
+   *
+   * @param value the deadline
+   */
+   void setDeadline(std::chrono::steady_clock::time_point value);
+
+   /**
+   * Removes the deadline.  The job is then never dropped as expired.
+   */
+   void clearDeadline();
+
+   /**
+   * @return true if the job has a deadline
+   */
+   bool hasDeadline()const
+   {
+      return m_hasDeadline.load(std::memory_order_acquire);
+   }
+
+   /**
+   * @return the deadline.  Only meaningful if hasDeadline is true.
+   */
+   std::chrono::steady_clock::time_point deadline()const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      return m_deadline;
+   }
+
+   /**
+   * @param now the current time
+   * @return true if the job has a deadline and it is not after now
+   */
+   bool isExpired(std::chrono::steady_clock::time_point now)const
+   {
+      return hasDeadline()&&(deadline() <= now);
+   }
+
    /**
    * If derived interfaces implement a block this will allow one to release.
    * Derived classes must override.
@@ -192,8 +248,7 @@ public:
    */
    State state()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return m_state;
+      return static_cast<State>(m_state.load(std::memory_order_acquire));
    }
 
    /**
@@ -201,21 +256,7 @@ public:
    *
    * @param value is the state you wish to reset to
    */
-   virtual void resetState(int value)
-   {
-      m_jobMutex.lock();
-      if(value != m_state)
-      {
-         m_state = multiJob_NONE;
-         m_jobMutex.unlock();
-         setState(value);
-      }
-      else 
-      {
-         m_jobMutex.unlock();
-      }
-
-   }
+   virtual void resetState(int value);
 
    /**
    * Will allow you to set the state of the job
@@ -232,8 +273,7 @@ public:
    */
    bool isCanceled()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return (m_state & multiJob_CANCEL);
+      return (m_state.load(std::memory_order_acquire) & multiJob_CANCEL);
    }
 
    /**
@@ -264,26 +304,14 @@ public:
    /**
    * Sets the state if the object as finished
    */
-   virtual void finished()
-   {
-      int newState = 0;
-      {
-         // maintain the cancel flag so we can indicate the job has now finished
-         std::lock_guard<std::mutex> lock(m_jobMutex);
-         newState = ((m_state & multiJob_CANCEL) | 
-            (multiJob_FINISHED));
-      }
-      // now reset to the new state
-      resetState(newState);
-   }
+   virtual void finished();
 
    /**
    * @return true if the state of the object is in a ready state.
    */
    bool isReady()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return m_state & multiJob_READY;
+      return (m_state.load(std::memory_order_acquire) & multiJob_READY);
    }
 
    /**
@@ -291,8 +319,7 @@ public:
    */
    bool isStopped()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return (m_state & multiJob_FINISHED);
+      return (m_state.load(std::memory_order_acquire) & multiJob_FINISHED);
    }
 
    /**
@@ -300,8 +327,7 @@ public:
    */
    bool isFinished()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return (m_state & multiJob_FINISHED);
+      return (m_state.load(std::memory_order_acquire) & multiJob_FINISHED);
    }
 
    /**
@@ -309,8 +335,7 @@ public:
    */
    bool isRunning()const
    {
-      std::lock_guard<std::mutex> lock(m_jobMutex);
-      return (m_state & multiJob_RUNNING);
+      return (m_state.load(std::memory_order_acquire) & multiJob_RUNNING);
    }
 
    /**
@@ -320,28 +345,16 @@ public:
    {
       std::lock_guard<std::mutex> lock(m_jobMutex);
       m_callback = callback;
+      m_hasCallback.store(callback != nullptr, std::memory_order_release);
    }
 
    /**
-   * Sets the name of a job
+   * Sets the name of a job.  A queue holding the job re-indexes it under the
+   * new name.
    *
    * @param value the name of the job
    */
-   void setName(const multiString& value)
-   {
-      bool changed = false;
-      std::shared_ptr<multiJobCallback> callback;
-      {
-         std::lock_guard<std::mutex> lock(m_jobMutex);
-         changed = value!=m_name;
-         m_name = value;
-         callback = m_callback;
-      }
-      if(changed&&callback)
-      {
-         callback->nameChanged(value, getSharedFromThis());
-      }
-   }
+   void setName(const multiString& value);
 
    /**
    * @return the name of the job
@@ -353,25 +366,11 @@ public:
    }
 
    /*
-   * sets the ID
+   * sets the ID.  A queue holding the job re-indexes it under the new id.
    *
    * @param value the id to set the job to
    */
-   void setId(const multiString& value)
-   {
-      bool changed = false;
-      std::shared_ptr<multiJobCallback> callback;
-      {
-         std::lock_guard<std::mutex> lock(m_jobMutex);
-         changed = value!=m_id;
-         m_id = value;
-         callback = m_callback;
-      }
-      if(changed&&callback)
-      {
-         callback->idChanged(value, getSharedFromThis());
-      }
-   }
+   void setId(const multiString& value);
 
    /*
    * @return id of the job
@@ -382,6 +381,54 @@ public:
       return m_id;
    }
 
+   /**
+   * Sets the tenant, or job class, the job is accounted to.  A queue in
+   * FAIR_SHARE_ORDERING shares dispatch between tenants by weight.  The
+   * tenant is read when the job is queued so a change takes effect the next
+   * time the job is added.
+   *
+   * @param value the tenant.  Empty is the default tenant.
+   */
+   void setTenant(const multiString& value)
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      m_tenant = value;
+      if(!value.empty()) m_hasKeys.store(true, std::memory_order_release);
+   }
+
+   /**
+   * @return the tenant of the job
+   */
+   multiString tenant()const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      return m_tenant;
+   }
+
+   /**
+   * @return true if a name, id or tenant was ever set on the job.  Lets a
+   *         queue skip reading them for plain jobs.
+   */
+   bool hasKeys()const
+   {
+      return m_hasKeys.load(std::memory_order_acquire);
+   }
+
+   /**
+   * Reads the name, id and tenant under a single lock
+   *
+   * @param name set to the name of the job
+   * @param id set to the id of the job
+   * @param tenant set to the tenant of the job
+   */
+   void keys(multiString& name, multiString& id, multiString& tenant)const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      name   = m_name;
+      id     = m_id;
+      tenant = m_tenant;
+   }
+
    /*
    * @param value the description to set on the job
    */
@@ -415,14 +462,108 @@ public:
    */
    std::shared_ptr<multiJobCallback> callback() {return m_callback;}
 
+   /**
+   * Puts the job in a group.  The group counts the job until it finishes,
+   * is canceled or is released without running.  Set the group before the
+   * job is added to a queue.  A job is in at most one group.  A job that
+   * already finished is not counted, the call does nothing.
+   *
+   * @param group the group or nullptr to leave the current group
+   */
+   void setGroup(std::shared_ptr<multi::JobGroup> group);
+
+   /**
+   * @return the group of the job or nullptr
+   */
+   std::shared_ptr<multi::JobGroup> group()const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      return m_group;
+   }
+
+   /**
+   * @return the exception thrown by run or nullptr if run did not throw
+   */
+   std::exception_ptr exception()const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      return m_exception;
+   }
+
+   /**
+   * Used by multiJobQueue to record the queue the job is currently waiting on.
+   * Pass an empty pointer once the job leaves the queue.
+   *
+   * @param q the queue holding the job
+   */
+   void setJobQueue(const std::weak_ptr<multiJobQueue>& q)
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      m_jobQueue = q;
+   }
+
+   /**
+   * @return the queue the job is currently waiting on or nullptr if it is
+   *         not queued
+   */
+   std::shared_ptr<multiJobQueue> jobQueue()const
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      return m_jobQueue.lock();
+   }
+
 protected:
    mutable std::mutex m_jobMutex;
    multiString m_name;
    multiString m_description;
    multiString m_id;
-   State       m_state;
+   multiString m_tenant;
+   std::atomic<int> m_state;
    double      m_priority;
    std::shared_ptr<multiJobCallback> m_callback;
+   std::weak_ptr<multiJobQueue>      m_jobQueue;
+   std::exception_ptr                m_exception;
+
+   /**
+   * Lets state changes skip the lock and the shared_from_this reference
+   * count when no callback is set
+   */
+   std::atomic<bool>                 m_hasCallback;
+
+   std::shared_ptr<multi::JobGroup>  m_group;
+
+   /**
+   * Lets start skip the lock when the job is not in a group
+   */
+   std::atomic<bool>                 m_hasGroup;
+
+   std::chrono::steady_clock::time_point m_deadline;
+
+   /**
+   * Lets the queue skip the lock and the clock when the job has no deadline
+   */
+   std::atomic<bool>                 m_hasDeadline;
+
+   /**
+   * Set once a name, id or tenant is set.  Never cleared.
+   */
+   std::atomic<bool>                 m_hasKeys;
+
+   /**
+   * Internal method that calls the callback for a state transition.  Only the
+   * first of ready, started, canceled and finished that was turned on is
+   * reported.
+   *
+   * @param oldState the state before the transition
+   * @param newState the state after the transition
+   */
+   void notifyStateChanged(int oldState, int newState);
+
+   /**
+   * Internal method that marks the job done in its group and leaves it.  Only
+   * the first call has an effect.
+   */
+   void leaveGroup();
 
    /**
    * Abstract method and must be overriden by the base class.  The base multiJob
@@ -431,4 +572,81 @@ protected:
    virtual void run()=0;
 };
 
+/**
+* A job that runs a callable such as a lambda so no subclass is needed.  The
+* callable is stored inside the job when it fits in INLINE_SIZE bytes and
+* is called through a plain function pointer.  Larger callables are stored on
+* the heap.
+*
+* Usually created by @see multiJobQueue::submit
+*
+* @code
+* std::shared_ptr<multiJob> job = std::make_shared<multiFunctionJob>([]{
+*    std::cout << "Running Job\n";
+* });
+* jobQueue->add(job);
+* @endcode
+*/
+class OSSIM_DLL multiFunctionJob : public multiJob
+{
+public:
+   /**
+   * Callables up to this size are stored inside the job
+   */
+   static const std::size_t INLINE_SIZE = 64;
+
+   /**
+   * @param f the callable.  It is called with no arguments and its result is
+   *        ignored
+   */
+   template<class F>
+   explicit multiFunctionJob(F&& f)
+   {
+      typedef typename std::decay<F>::type Fn;
+      store<Fn>(std::forward<F>(f), 
+                std::integral_constant<bool, (sizeof(Fn) <= INLINE_SIZE)&&
+                                             (alignof(Fn) <= alignof(std::max_align_t))>());
+      m_invoke = &invoke<Fn>;
+   }
+
+   virtual ~multiFunctionJob()
+   {
+      m_destroy(m_callable);
+   }
+
+protected:
+   virtual void run()
+   {
+      m_invoke(m_callable);
+   }
+
+private:
+   typedef void (*Function)(void*);
+
+   template<class Fn, class F>
+   void store(F&& f, std::true_type)
+   {
+      m_callable = new(&m_storage) Fn(std::forward<F>(f));
+      m_destroy  = &destroyInline<Fn>;
+   }
+   template<class Fn, class F>
+   void store(F&& f, std::false_type)
+   {
+      m_callable = new Fn(std::forward<F>(f));
+      m_destroy  = &destroyHeap<Fn>;
+   }
+
+   template<class Fn>
+   static void invoke(void* callable){(*static_cast<Fn*>(callable))();}
+   template<class Fn>
+   static void destroyInline(void* callable){static_cast<Fn*>(callable)->~Fn();}
+   template<class Fn>
+   static void destroyHeap(void* callable){delete static_cast<Fn*>(callable);}
+
+   typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_storage;
+   void*    m_callable;
+   Function m_invoke;
+   Function m_destroy;
+};
+
 #endif
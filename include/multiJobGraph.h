@@ -0,0 +1,167 @@
+#ifndef multiJobGraph_HEADER
+#define multiJobGraph_HEADER
+#include <multiJob.h>
+#include <multiJobQueue.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <exception>
+
+/**
+* multiJobGraph runs a set of jobs that depend on each other.  Jobs are added
+* as nodes and an edge from a to b means b only starts after a has finished.
+* Each node keeps an atomic count of the predecessors that have not finished.
+* The worker that finishes a node's last predecessor adds the node to the queue
+* right away, so no finished callbacks are needed to chain jobs.
+*
+* If a node's job throws or is canceled the rest of the graph is canceled.
+*
+* @code
+* std::shared_ptr<multiJobGraph> graph = std::make_shared<multiJobGraph>();
+* multiJobGraph::Node read    = graph->addFunction([&]{ readTile(); });
+* multiJobGraph::Node filter  = graph->addFunction([&]{ filterTile(); });
+* multiJobGraph::Node write   = graph->addFunction([&]{ writeTile(); });
+* graph->addEdge(read, filter);
+* graph->addEdge(filter, write);
+* graph->run(jobQueue);
+* graph->wait();
+* @endcode
+*/
+class OSSIM_DLL multiJobGraph : public std::enable_shared_from_this<multiJobGraph>
+{
+public:
+   typedef std::size_t Node;
+
+   /**
+   * Returned by add when the node could not be added
+   */
+   static const Node INVALID_NODE = static_cast<Node>(-1);
+
+   multiJobGraph();
+   virtual ~multiJobGraph();
+
+   /**
+   * Adds a node.  Nodes can not be added once the graph is running.
+   *
+   * @param job the job to run for the node
+   * @return the node or INVALID_NODE if job is nullptr or run was called
+   */
+   Node add(std::shared_ptr<multiJob> job);
+
+   /**
+   * Adds a node that runs a callable.
+   *
+   * @param f the callable to run
+   * @return the node or INVALID_NODE if run was called
+   */
+   template<class F>
+   Node addFunction(F&& f)
+   {
+      return add(std::make_shared<multiFunctionJob>(std::forward<F>(f)));
+   }
+
+   /**
+   * Makes node to start only after node from has finished.
+   *
+   * @param from the node that runs first
+   * @param to the node that depends on from
+   * @return false if a node is not valid or the graph is running
+   */
+   bool addEdge(Node from, Node to);
+
+   /**
+   * Adds the nodes without predecessors to the queue.  The others are added
+   * as their predecessors finish.  A graph runs once.
+   *
+   * @param jobQueue the queue the nodes are added to
+   * @return false if the graph has already been run, has a cycle or
+   *         jobQueue is nullptr
+   */
+   bool run(std::shared_ptr<multiJobQueue> jobQueue);
+
+   /**
+   * Blocks until every node has finished or, after a cancel, until the
+   * nodes that were running have returned.  Returns right away if the graph
+   * has not been run.
+   */
+   void wait();
+
+   /**
+   * Same as wait with a time limit
+   *
+   * @param waitTimeMillis the maximum time to wait in milliseconds
+   * @return true if the graph is done
+   */
+   bool waitFor(unsigned long long waitTimeMillis);
+
+   /**
+   * Stops releasing nodes and cancels the nodes that are queued.  Nodes that
+   * are running are left to finish.
+   */
+   void cancel();
+
+   /**
+   * @return true if cancel was called or a node failed
+   */
+   bool isCanceled()const;
+
+   /**
+   * @return true if every node has finished or the graph was canceled and
+   *         nothing is running
+   */
+   bool isDone()const;
+
+   /**
+   * @return the first exception thrown by a node's job or nullptr
+   */
+   std::exception_ptr exception()const;
+
+   /**
+   * @return the number of nodes
+   */
+   std::size_t size()const;
+
+   /**
+   * @param node the node
+   * @return the job of the node or nullptr if node is not valid
+   */
+   std::shared_ptr<multiJob> job(Node node)const;
+
+protected:
+   class NodeJob;
+   friend class NodeJob;
+
+   /**
+   * Called by a node after its job has returned
+   *
+   * @param node the node that finished
+   * @param failedFlag true if the job threw or was canceled
+   */
+   void nodeFinished(NodeJob* node, bool failedFlag);
+
+   /**
+   * Called by a node before its job starts.
+   *
+   * @return false if the graph is canceled and the job must not start
+   */
+   bool nodeStarting();
+
+   /**
+   * Must be called with m_graphMutex held
+   */
+   bool isDoneNoLock()const;
+
+   mutable std::mutex m_graphMutex;
+   std::condition_variable m_doneCondition;
+   std::vector<std::shared_ptr<NodeJob> > m_nodes;
+   std::shared_ptr<multiJobQueue> m_jobQueue;
+   std::atomic<std::size_t> m_remaining;
+   std::size_t        m_runningCount;
+   bool               m_startedFlag;
+   std::atomic<bool>  m_canceledFlag;
+   std::exception_ptr m_exception;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef multiJobGroup_HEADER
+#define multiJobGroup_HEADER
+#include <multiConstants.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+namespace multi{
+
+   /**
+   * JobGroup counts the jobs of a batch that have not completed and lets a
+   * caller block until the count reaches zero.  A job joins a group with
+   * multiJob::setGroup and leaves it when it finishes, is canceled or is
+   * released without running.  The waiters are woken once, by the last job.
+   *
+   * @code
+   * std::shared_ptr<multi::JobGroup> group = std::make_shared<multi::JobGroup>();
+   * for(auto& job:jobs)
+   * {
+   *    job->setGroup(group);
+   *    jobQueue->add(job);
+   * }
+   * group->wait();
+   * @endcode
+   */
+   class OSSIM_DLL JobGroup
+   {
+   public:
+      JobGroup();
+
+      /**
+      * Adds to the number of outstanding jobs.  Called by multiJob::setGroup.
+      *
+      * @param count the number to add
+      */
+      void add(std::size_t count=1);
+
+      /**
+      * Marks one outstanding job done.  Wakes the waiters when it was the
+      * last one.
+      */
+      void done();
+
+      /**
+      * Blocks until there are no outstanding jobs
+      */
+      void wait();
+
+      /**
+      * Same as wait with a time limit
+      *
+      * @param waitTimeMillis the maximum time to wait in milliseconds
+      * @return true if there are no outstanding jobs
+      */
+      bool waitFor(unsigned long long waitTimeMillis);
+
+      /**
+      * @return the number of outstanding jobs
+      */
+      std::size_t count()const{return m_count.load(std::memory_order_acquire);}
+
+   private:
+      JobGroup(const JobGroup&);
+      JobGroup& operator=(const JobGroup&);
+
+      std::atomic<std::size_t> m_count;
+      std::mutex               m_mutex;
+      std::condition_variable  m_condition;
+   };
+}
+
+#endif
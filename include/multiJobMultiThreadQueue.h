@@ -1,8 +1,56 @@
 #ifndef multiJobMultiThreadQueue_HEADER
 #define multiJobMultiThreadQueue_HEADER
 #include <multiJobThreadQueue.h>
+#include <multiCpuTopology.h>
 #include <mutex>
 #include <vector>
+#include <atomic>
+
+namespace multi{
+
+   /**
+   * ScalingPolicy sets the bounds and thresholds used by a
+   * multiJobMultiThreadQueue that sizes itself.  The pool is checked every
+   * checkIntervalMillis.  It grows, at most doubling per check, when more than
+   * queueDepthThreshold jobs are queued or the oldest queued job has waited
+   * longer than waitThresholdMillis.  Threads that have been idle for
+   * keepAliveMillis are retired down to minThreads.
+   *
+   * A threshold of 0 disables that trigger.
+   */
+   class OSSIM_DLL ScalingPolicy
+   {
+   public:
+      ScalingPolicy(unsigned int minThreads=1,
+                    unsigned int maxThreads=static_cast<unsigned int>(multi::Thread::getNumberOfProcessors()),
+                    std::size_t queueDepthThreshold=1,
+                    unsigned long long waitThresholdMillis=10,
+                    unsigned long long keepAliveMillis=60000,
+                    unsigned long long checkIntervalMillis=100)
+      :m_minThreads(minThreads),
+       m_maxThreads((maxThreads > minThreads)?maxThreads:minThreads),
+       m_queueDepthThreshold(queueDepthThreshold),
+       m_waitThresholdMillis(waitThresholdMillis),
+       m_keepAliveMillis(keepAliveMillis),
+       m_checkIntervalMillis((checkIntervalMillis > 0)?checkIntervalMillis:1)
+      {}
+
+      unsigned int minThreads()const{return m_minThreads;}
+      unsigned int maxThreads()const{return m_maxThreads;}
+      std::size_t queueDepthThreshold()const{return m_queueDepthThreshold;}
+      unsigned long long waitThresholdMillis()const{return m_waitThresholdMillis;}
+      unsigned long long keepAliveMillis()const{return m_keepAliveMillis;}
+      unsigned long long checkIntervalMillis()const{return m_checkIntervalMillis;}
+
+   private:
+      unsigned int       m_minThreads;
+      unsigned int       m_maxThreads;
+      std::size_t        m_queueDepthThreshold;
+      unsigned long long m_waitThresholdMillis;
+      unsigned long long m_keepAliveMillis;
+      unsigned long long m_checkIntervalMillis;
+   };
+}
 
 /**
 * This allocates a thread pool used to listen on a shared job queue
@@ -54,10 +102,7 @@
 *       jobQueue->add(job);
 *    }
 * 
-*    while(jobThreadQueue->hasJobsToProcess())
-*    {
-*       multi::Thread::sleepInMilliSeconds(10);
-*    }
+*    jobThreadQueue->waitForIdle();
 * 
 *    std::cout << "Finished and cancelling thread queue\n";
 *    jobThreadQueue->cancel();
@@ -71,6 +116,27 @@ class OSSIM_DLL multiJobMultiThreadQueue
 {
 public:
    typedef std::vector<std::shared_ptr<multiJobThreadQueue> > ThreadQueueList;
+
+   /**
+   * How the pool sets the CPU affinity of its threads.
+   *
+   * NO_PLACEMENT       lets the scheduler decide.
+   * COMPACT_PLACEMENT  pins thread i to the i-th processor, filling one NUMA
+   *                    node before the next.
+   * SCATTER_PLACEMENT  pins threads round robin across the NUMA nodes.
+   * EXPLICIT_PLACEMENT pins thread i to the i-th processor of the given list.
+   *
+   * Placement is thread affinity only.  All threads still take jobs from the
+   * one shared queue, so a job may run on any node, and no memory policy is
+   * set.  When there are more threads than processors the placement wraps.
+   */
+   enum PlacementMode
+   {
+      NO_PLACEMENT       = 0,
+      COMPACT_PLACEMENT  = 1,
+      SCATTER_PLACEMENT  = 2,
+      EXPLICIT_PLACEMENT = 3
+   };
    
    /**
    * allows one to create a pool of threads with a shared job queue
@@ -125,6 +191,118 @@ public:
    */
    bool hasJobsToProcess()const;
 
+   /**
+   * Blocks until the shared queue is empty and every thread is out of work.
+   * The caller is woken when the last thread goes idle, so there is no
+   * polling.  Threads that spin before blocking count as busy until they
+   * block.  @see multi::JobGroup to wait for a set of jobs instead.
+   */
+   void waitForIdle()const;
+
+   /**
+   * Same as waitForIdle with a time limit
+   *
+   * @param waitTimeMillis the maximum time to wait in milliseconds
+   * @return true if idle
+   */
+   bool waitForIdle(unsigned long long waitTimeMillis)const;
+
+   /**
+   * Sets the number of jobs each thread claims from the shared queue per
+   * lock acquisition.  @see multiJobThreadQueue::setBatchSize
+   *
+   * @param batchSize number of jobs per claim
+   */
+   void setBatchSize(std::size_t batchSize);
+
+   /**
+   * @return the number of jobs each thread claims per lock acquisition
+   */
+   std::size_t batchSize()const;
+
+   /**
+   * Sets what each thread does when it runs out of work.
+   * @see multiJobThreadQueue::setIdlePolicy
+   *
+   * @param policy the idle policy
+   */
+   void setIdlePolicy(const multi::IdlePolicy& policy);
+
+   /**
+   * @return the idle policy given to each thread
+   */
+   multi::IdlePolicy idlePolicy()const;
+
+   /**
+   * Enables work stealing.  Each thread is given its own deque and jobs added
+   * through @see add from inside a pool thread go to that thread's deque
+   * instead of the shared job queue.  Idle threads pull from the shared queue
+   * and then steal from their peers.  The shared queue remains the injection
+   * queue for jobs added from outside the pool.
+   *
+   * Disabling stops routing new jobs to the deques.  Jobs already on a deque
+   * are still run.
+   *
+   * @param flag true to enable work stealing
+   */
+   void setWorkStealing(bool flag);
+
+   /**
+   * @return true if work stealing is enabled
+   */
+   bool isWorkStealing()const;
+
+   /**
+   * Adds a job to the pool.  If work stealing is enabled and the caller is
+   * one of the pool threads the job is pushed onto that thread's deque,
+   * otherwise it is added to the shared job queue.  A job pushed onto a deque
+   * wakes one parked thread through multiJobQueue::wakeConsumer so it can
+   * steal it.
+   *
+   * Jobs on a deque are not visible to the shared queue's callback, remove
+   * and size methods.
+   *
+   * @param job the job to add
+   */
+   void add(std::shared_ptr<multiJob> job);
+
+   /**
+   * Lets the pool size itself between the policy's minimum and maximum
+   * number of threads.  A monitor thread grows the pool when jobs back up on
+   * the queue and retires threads that stay idle.  @see multi::ScalingPolicy
+   *
+   * setNumberOfThreads may still be called.  The monitor will move the count
+   * back inside the bounds.
+   *
+   * @param policy the scaling bounds and thresholds
+   */
+   void setAutoScaling(const multi::ScalingPolicy& policy);
+
+   /**
+   * Stops sizing the pool automatically.  The current threads are kept.
+   */
+   void disableAutoScaling();
+
+   /**
+   * @return true if the pool is sizing itself
+   */
+   bool isAutoScaling()const;
+
+   /**
+   * Sets the CPU affinity of the threads and re-pins the current threads.
+   * Threads report the node they are pinned to through
+   * multiJobThreadQueue::currentNumaNode.  Pinning is only done on Linux.
+   *
+   * @param mode the placement mode
+   * @param cpus processor ids used by EXPLICIT_PLACEMENT
+   */
+   void setPlacement(PlacementMode mode, const std::vector<int>& cpus=std::vector<int>());
+
+   /**
+   * @return the placement mode
+   */
+   PlacementMode placementMode()const;
+
    /**
    * Allows one to cancel all threads
    */
@@ -137,9 +315,59 @@ public:
    void waitForCompletion();
 
 protected:
+   class ScalingThread;
+
+   /**
+   * Internal method that creates count threads.  Must be called with m_mutex
+   * held
+   *
+   * @param count the number of threads to add
+   */
+   void addThreads(std::size_t count);
+
+   /**
+   * Internal method that pins every thread according to the placement
+   * mode.  Must be called with m_mutex held
+   */
+   void applyPlacement();
+
+   /**
+   * Internal method called by the scaling thread that grows or shrinks the
+   * pool according to the scaling policy.
+   */
+   void adjustThreads();
+
+   /**
+   * Internal method that stops the threads in parallel and waits for them.
+   *
+   * @param threads the threads to stop.  They must not be in m_threadQueueList
+   * @param cancelCurrentJobFlag @see multiJobThreadQueue::stop
+   */
+   static void stopThreads(const ThreadQueueList& threads, bool cancelCurrentJobFlag);
+
+   /**
+   * Internal method that gives every thread a deque if work stealing is
+   * enabled and publishes the current set of deques to all threads.  Must be
+   * called with m_mutex held.
+   */
+   void updateStealPeers();
+
    mutable std::mutex             m_mutex;
    std::shared_ptr<multiJobQueue> m_jobQueue;
    ThreadQueueList                m_threadQueueList;
+   std::atomic<bool>              m_workStealing;
+   std::size_t                    m_batchSize;
+   multi::IdlePolicy              m_idlePolicy;
+   multi::ScalingPolicy           m_scalingPolicy;
+   std::shared_ptr<ScalingThread> m_scalingThread;
+   PlacementMode                  m_placementMode;
+   std::vector<int>               m_placementCpus;
+   std::shared_ptr<const multi::CpuTopology> m_topology;
+
+   /**
+   * Notified by the threads when they run out of work
+   */
+   std::shared_ptr<multi::EventCount> m_idleEvent;
 };
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef multiJobPool_HEADER
+#define multiJobPool_HEADER
+#include <multiJob.h>
+#include <multiFreeList.h>
+#include <vector>
+#include <utility>
+
+namespace multi{
+
+   /**
+   * JobPool creates jobs of type T whose memory is recycled.  Each job and
+   * its shared_ptr control block are made in a single block taken from the
+   * pool's FreeList.  When the last shared_ptr to a job is released the job is
+   * destroyed and the block goes back to the pool for the next create, so a
+   * steady stream of jobs does not touch the heap.
+   *
+   * Jobs may outlive the pool.  The pool memory is released once the pool and
+   * every job it created are gone.
+   *
+   * @code
+   * multi::JobPool<MyJob> pool;
+   * pool.reserve(64);
+   * for(;;)
+   * {
+   *    jobQueue->add(pool.create(arg1, arg2));
+   * }
+   * @endcode
+   */
+   template<class T>
+   class JobPool
+   {
+   public:
+      JobPool()
+      :m_freeList(std::make_shared<FreeList>())
+      {}
+
+      /**
+      * Creates a job with the given constructor arguments.
+      *
+      * @return the job
+      */
+      template<class... Args>
+      std::shared_ptr<T> create(Args&&... args)
+      {
+         return std::allocate_shared<T>(FreeListAllocator<T>(m_freeList),
+                                        std::forward<Args>(args)...);
+      }
+
+      /**
+      * Makes sure at least count blocks are free so the first creates do not
+      * go to the heap either.  The pool keeps at least count free blocks from
+      * then on.  T must be default constructible.
+      *
+      * @param count the number of blocks
+      */
+      void reserve(std::size_t count)
+      {
+         if(m_freeList->maxFree() < count) m_freeList->setMaxFree(count);
+         std::vector<std::shared_ptr<T> > jobs;
+         jobs.reserve(count);
+         while(m_freeList->freeCount() + jobs.size() < count)
+         {
+            jobs.push_back(create());
+         }
+      }
+
+      /**
+      * @return the number of blocks waiting to be reused
+      */
+      std::size_t freeCount()const{return m_freeList->freeCount();}
+
+      /**
+      * Sets the most free blocks the pool keeps.  Released jobs past that go
+      * back to the heap.  @see FreeList::setMaxFree
+      *
+      * @param maxFree the most free blocks
+      */
+      void setMaxFree(std::size_t maxFree){m_freeList->setMaxFree(maxFree);}
+
+   private:
+      std::shared_ptr<FreeList> m_freeList;
+   };
+}
+
+#endif
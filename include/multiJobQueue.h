@@ -9,10 +9,18 @@
 #define multiJobQueue_HEADER
 
 #include <multiJob.h>
+#include <multiFreeList.h>
+#include <multiJobPool.h>
+#include <multiJobResult.h>
+#include <multiPeriodicJob.h>
 #include <mutex>
 #include <memory>
 #include <condition_variable>
 #include <atomic>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
 namespace multi{
 
    /**
@@ -70,6 +78,16 @@ namespace multi{
       */
       void set(bool releaseFlag);
 
+      /**
+      * Will set the release flag and wake up at most wakeCount threads to test
+      * the condition again.  Used when only a known number of waiters can make
+      * progress, for example after adding a batch of jobs.
+      *
+      * @param releaseFlag the release state
+      * @param wakeCount maximum number of blocked threads to wake
+      */
+      void set(bool releaseFlag, std::size_t wakeCount);
+
       /**
       * Will block the calling thread based on the internal condition.  If the internal
       * condition is set to release then it will return without blocking.
@@ -125,6 +143,96 @@ namespace multi{
       */ 
       std::condition_variable m_conditionalWait;
    };
+
+   /**
+   * EventCount is a wakeup primitive that wakes only as many waiters as there
+   * is new work for.  A waiter registers with prepareWait, checks its condition
+   * again and then either calls cancelWait or waits on the key it was given.
+   * A notify that happens after prepareWait makes the wait return so no wakeup
+   * is lost.  When there are no waiters a notify is a single atomic load.
+   *
+   * @code
+   * // waiter
+   * while(!conditionIsTrue())
+   * {
+   *    multi::EventCount::Key key = eventCount.prepareWait();
+   *    if(conditionIsTrue())
+   *    {
+   *       eventCount.cancelWait();
+   *       break;
+   *    }
+   *    eventCount.wait(key);
+   * }
+   *
+   * // notifier
+   * makeConditionTrue();
+   * eventCount.notify(1);
+   * @endcode
+   */
+   class OSSIM_DLL EventCount
+   {
+   public:
+      typedef unsigned long long Key;
+
+      EventCount();
+
+      /**
+      * Registers the calling thread as a waiter.  Must be followed by
+      * either cancelWait or wait.
+      *
+      * @return the key to pass to wait
+      */
+      Key prepareWait();
+
+      /**
+      * Unregisters a waiter that found its condition true after prepareWait.
+      */
+      void cancelWait();
+
+      /**
+      * Blocks until a notify has happened since the key was taken.
+      *
+      * @param key the value returned by prepareWait
+      */
+      void wait(Key key);
+
+      /**
+      * Blocks until a notify has happened since the key was taken or the time
+      * has elapsed.
+      *
+      * @param key the value returned by prepareWait
+      * @param waitTimeMillis the maximum time to wait in milliseconds
+      * @return true if notified and false if the time elapsed
+      */
+      bool wait(Key key, unsigned long long waitTimeMillis);
+
+      /**
+      * Wakes at most count waiters.
+      *
+      * @param count the number of waiters to wake
+      */
+      void notify(std::size_t count=1);
+
+      /**
+      * Wakes all waiters.
+      */
+      void notifyAll();
+
+      /**
+      * @return the number of threads between prepareWait and the end of their wait
+      */
+      int waitCount()const;
+
+   private:
+      mutable std::mutex      m_mutex;
+      std::condition_variable m_conditionVariable;
+
+      /**
+      * Advanced by every notify while there are waiters
+      */
+      std::atomic<Key>        m_epoch;
+      std::atomic<int>        m_waitCount;
+   };
 }
 
 /**
@@ -225,6 +333,38 @@ public:
       virtual void added(std::shared_ptr<multiJobQueue> /*q*/, 
                          std::shared_ptr<multiJob> /*job*/){}
 
+      /**
+      * Called just before a batch of jobs is added with addAll.  The default
+      * calls adding for each job.
+      *
+      * @param q Is a shared_ptr to 'this' job queue
+      * @param jobs Are the jobs we are adding
+      */
+      virtual void addingBatch(std::shared_ptr<multiJobQueue> q, 
+                               const multiJob::List& jobs)
+      {
+         for(multiJob::List::const_iterator iter = jobs.begin();iter != jobs.end();++iter)
+         {
+            adding(q, *iter);
+         }
+      }
+
+      /**
+      * Called once after a batch of jobs is added with addAll.  The default
+      * calls added for each job.
+      *
+      * @param q Is a shared_ptr to 'this' job queue
+      * @param jobs Are the jobs that were added
+      */
+      virtual void addedBatch(std::shared_ptr<multiJobQueue> q, 
+                              const multiJob::List& jobs)
+      {
+         for(multiJob::List::const_iterator iter = jobs.begin();iter != jobs.end();++iter)
+         {
+            added(q, *iter);
+         }
+      }
+
 
       /**
       * Called after a job is removed from the queue
@@ -235,10 +375,57 @@ public:
                            std::shared_ptr<multiJob>/*job*/){}
    };
 
+   /**
+   * Controls the order jobs are handed out by nextJob.
+   */
+   enum OrderingMode
+   {
+      /** Jobs are dispatched in the order they were added */
+      FIFO_ORDERING     = 0,
+      /**
+      * Jobs are dispatched highest multiJob::priority() first and in the order
+      * they were added within the same priority.
+      */
+      PRIORITY_ORDERING = 1,
+      /**
+      * Jobs are dispatched earliest multiJob::deadline() first.  Jobs without
+      * a deadline go after all jobs with one, in the order they were added.
+      */
+      DEADLINE_ORDERING = 2,
+      /**
+      * Jobs are dispatched round robin between multiJob::tenant() values so
+      * one tenant flooding the queue can not starve the others.  Each turn
+      * a tenant gets as many jobs as its weight.  @see setTenantWeight.
+      * Jobs of the same tenant are dispatched in the order they were added.
+      */
+      FAIR_SHARE_ORDERING = 3
+   };
+
+   /**
+   * Counters kept for every tenant seen by the queue
+   */
+   struct TenantStats
+   {
+      multiString        tenant;
+      /** jobs dispatched per turn in FAIR_SHARE_ORDERING */
+      unsigned int       weight;
+      /** jobs of the tenant on the queue */
+      std::size_t        depth;
+      /** jobs of the tenant handed out by nextJob and nextJobs */
+      unsigned long long dispatched;
+   };
+
    /**
    * Default constructor
+   *
+   * @param mode the order in which jobs are dispatched
+   */
+   multiJobQueue(OrderingMode mode=FIFO_ORDERING);
+
+   /**
+   * Destructor
    */
-   multiJobQueue();
+   virtual ~multiJobQueue();
   
    /**
    * This is the safe way to create a std::shared_ptr for 'this'.  Calls the derived
@@ -257,17 +444,278 @@ public:
    }
 
    /**
-   * Will add a job to the queue and if the guaranteeUniqueFlag is set it will
-   * scan and make sure the job is not on the queue before adding
+   * Sets the order in which jobs are dispatched.  Jobs already on the
+   * queue are re-ordered as if they had been added in the same order under
+   * the new mode, so switching back to FIFO_ORDERING restores their arrival
+   * order.
+   *
+   * @param mode the ordering mode
+   */
+   virtual void setOrderingMode(OrderingMode mode);
+
+   /**
+   * @return the ordering mode
+   */
+   OrderingMode orderingMode()const;
+
+   /**
+   * Turns on priority aging in PRIORITY_ORDERING so low priority jobs are not
+   * starved under sustained load.  A job's effective priority is its
+   * priority plus priorityPerSecond for every second it has been queued.
+   * Since every queued job gains at the same rate the order between two jobs
+   * never changes while they wait, so each job is keyed once, by priority
+   * and queue time, and the next job is still the head of the first band.
+   * Changing the rate rekeys the queued jobs.
+   *
+   * @param priorityPerSecond the priority gained per second of waiting.  0,
+   *        the default, turns aging off.
+   */
+   void setPriorityAging(double priorityPerSecond);
+
+   /**
+   * @return the priority gained per second of waiting
+   */
+   double priorityAging()const;
+
+   /**
+   * @return the longest wait, in milliseconds, of a job taken from the queue
+   *         in PRIORITY_ORDERING, keyed by the lower bound of the wait stats
+   *         band of its priority.  See setWaitStatsBands.
+   */
+   std::map<double, unsigned long long> maxWaitMillisByPriority()const;
+
+   /**
+   * Clears the waits reported by maxWaitMillisByPriority
+   */
+   void resetMaxWait();
+
+   /**
+   * Sets the priority bands the waits of maxWaitMillisByPriority are kept
+   * for.  A job counts toward the band with the highest lower bound not
+   * above its priority, and toward the lowest band if its priority is below
+   * all of them, so the stats stay bounded however many priorities are used.
+   * Clears the waits kept so far.
+   *
+   * @param lowerBounds the lower bounds of the bands.  Empty means a single
+   *        band, the default.
+   */
+   void setWaitStatsBands(const std::vector<double>& lowerBounds);
+
+   /**
+   * @return the sorted lower bounds of the wait stats bands
+   */
+   std::vector<double> waitStatsBands()const;
+
+   /**
+   * Sets the share of a tenant in FAIR_SHARE_ORDERING.  A tenant with weight
+   * 3 gets three jobs dispatched for every one of a tenant with weight 1
+   * while both have jobs queued.  Tenants default to weight 1.
+   *
+   * @param tenant the tenant
+   * @param weight jobs per turn.  At least 1.
+   */
+   void setTenantWeight(const multiString& tenant, unsigned int weight);
+
+   /**
+   * @param tenant the tenant
+   * @return the counters of the tenant.  All zero with weight 1 if the queue
+   *         has not seen it.
+   */
+   TenantStats tenantStats(const multiString& tenant)const;
+
+   /**
+   * @return the counters of every tenant the queue has seen.  Tenants are
+   *         kept for the life of the queue.
+   */
+   std::vector<TenantStats> allTenantStats()const;
+
+   /**
+   * Sets the maximum number of jobs the queue holds.  When the queue is full
+   * add blocks until a consumer frees space, tryAdd fails and addFor waits up to
+   * its timeout.  Lowering the capacity does not remove queued jobs.
+   *
+   * @param capacity maximum number of queued jobs.  0 means unbounded.
+   */
+   virtual void setCapacity(std::size_t capacity);
+
+   /**
+   * @return the maximum number of queued jobs or 0 if unbounded
+   */
+   virtual std::size_t capacity()const;
+
+   /**
+   * Will add a job to the queue.  Queued jobs are indexed by pointer so the
+   * check for a job already on the queue is O(1).  If the queue has a
+   * capacity and is full the caller blocks until there is space or until
+   * releaseProducers or clear is called.  releaseBlock only wakes consumers
+   * and does not end the wait.
    *
    * @param job The job to add to the queue.
-   * @param guaranteeUniqueFlag if set to true will force a find to make sure the job
-   *        does not already exist
+   * @param guaranteeUniqueFlag if true a job already on the queue is not
+   *        added again.  If false the job is queued once more and runs once
+   *        for each time it was added.
+   * @return true if the job was queued, false if it is already queued or the
+   *         wait for space was ended by releaseProducers or clear
    */
-   virtual void add(std::shared_ptr<multiJob> job, bool guaranteeUniqueFlag=true);
+   virtual bool add(std::shared_ptr<multiJob> job, bool guaranteeUniqueFlag=true);
+
+   /**
+   * Will add a job to the queue if there is space without blocking.
+   *
+   * @param job The job to add to the queue.
+   * @return true if the job was added, false if the queue is full or the job
+   *         is already queued
+   */
+   virtual bool tryAdd(std::shared_ptr<multiJob> job);
+
+   /**
+   * Will add a job to the queue waiting up to waitTimeMillis for space if the
+   * queue is full.
+   *
+   * @param job The job to add to the queue.
+   * @param waitTimeMillis the maximum time to wait for space in milliseconds
+   * @return true if the job was added, false if the queue stayed full, the
+   *         wait was ended by releaseProducers or clear or the job is already
+   *         queued
+   */
+   virtual bool addFor(std::shared_ptr<multiJob> job, unsigned long long waitTimeMillis);
+
+   /**
+   * Adds the job to the queue at the given time without holding a thread
+   * until then.  The job waits on the shared multi::JobTimer and is added
+   * ignoring the capacity once due.  A job canceled while it waits is
+   * dropped.  If the time has passed the job is added right away.
+   *
+   * @code
+   * jobQueue->addAfter(retryJob, std::chrono::seconds(5));
+   * @endcode
+   *
+   * @param job the job to add
+   * @param when the time to add it
+   */
+   void addAt(std::shared_ptr<multiJob> job, std::chrono::steady_clock::time_point when);
+
+   /**
+   * Adds the job to the queue once delay has elapsed.  @see addAt
+   *
+   * @param job the job to add
+   * @param delay how long to wait
+   */
+   template<class Rep, class Period>
+   void addAfter(std::shared_ptr<multiJob> job, const std::chrono::duration<Rep, Period>& delay)
+   {
+      addAt(job, std::chrono::steady_clock::now() +
+                 std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+   }
+
+   /**
+   * Runs the job on this queue every period until it is canceled.  Between
+   * runs the job waits on the shared multi::JobTimer so it holds no thread.
+   * @see multiPeriodicJob
+   *
+   * @param job the job
+   * @param initialDelay the time until the first run
+   */
+   void addPeriodic(std::shared_ptr<multiPeriodicJob> job,
+                    multiPeriodicJob::Clock::duration initialDelay = multiPeriodicJob::Clock::duration::zero());
+
+   /**
+   * Runs a callable on this queue every period until the returned job is
+   * canceled.
+   *
+   * @code
+   * std::shared_ptr<multiPeriodicJob> job =
+   *    jobQueue->addPeriodicFunction([]{ flushStats(); }, std::chrono::seconds(10));
+   * ...
+   * job->cancel();
+   * @endcode
+   *
+   * @param f the callable
+   * @param period the time between runs
+   * @param mode FIXED_RATE or FIXED_DELAY
+   * @param missedPolicy @see multiPeriodicJob::MissedPolicy
+   * @return the job.  Cancel it to stop the runs.
+   */
+   template<class F>
+   std::shared_ptr<multiPeriodicJob> addPeriodicFunction(F&& f,
+                                                         multiPeriodicJob::Clock::duration period,
+                                                         multiPeriodicJob::Mode mode = multiPeriodicJob::FIXED_RATE,
+                                                         multiPeriodicJob::MissedPolicy missedPolicy = multiPeriodicJob::SKIP_MISSED)
+   {
+      typedef multiPeriodicFunctionJob<typename std::decay<F>::type> Job;
+      std::shared_ptr<multiPeriodicJob> job = std::make_shared<Job>(std::forward<F>(f), period, mode, missedPolicy);
+      addPeriodic(job, period);
+
+      return job;
+   }
+
+   /**
+   * Will add a batch of jobs taking the queue lock once and waking at most
+   * one blocked thread per job added.  Jobs already on the queue are skipped.
+   * The callback is notified through addingBatch and addedBatch.
+   *
+   * If the queue has a capacity the jobs that fit are handed to consumers and
+   * the caller blocks until there is space for the rest.  addingBatch and
+   * addedBatch are then called once for each part of the batch, and a job is
+   * only made ready once its part has room.  releaseProducers and clear end
+   * the wait and the jobs that did not fit are not queued, announced or
+   * touched.
+   *
+   * @param jobs The jobs to add to the queue.
+   * @param ignoreCapacity if true the capacity is not enforced and the call
+   *        never blocks.  Every job is queued, none is dropped.  Used by
+   *        workers to return jobs that were claimed but not run and to add
+   *        follow-up work they must not wait on.
+   * @return the number of jobs queued
+   */
+   virtual std::size_t addAll(const multiJob::List& jobs, bool ignoreCapacity=false);
+
+   /**
+   * Convenience that adds the range of jobs [first, last) with addAll.
+   *
+   * @param first iterator to the first std::shared_ptr<multiJob>
+   * @param last iterator past the last job
+   */
+   template<class Iterator>
+   void add(Iterator first, Iterator last)
+   {
+      addAll(multiJob::List(first, last));
+   }
+
+   /**
+   * Wraps a callable in a multiFunctionJob and adds it.  The job memory comes
+   * from a pool owned by the queue and small callables are stored inside the
+   * job, so a steady stream of submits does not allocate beyond the recycled
+   * blocks.  Blocks like add if the queue is full.
+   *
+   * The returned handle gives the value returned by the callable, or
+   * rethrows the exception it threw.  If the job is canceled or removed
+   * before it runs the handle reports multi::JobNotRun.
+   *
+   * @code
+   * multi::JobResult<int> result = jobQueue->submit([]{ return 6*7; });
+   * int answer = result.get();
+   * @endcode
+   *
+   * @param f the callable to run
+   * @return handle to the result and the job
+   */
+   template<class F>
+   multi::JobResult<typename std::result_of<typename std::decay<F>::type()>::type> submit(F&& f)
+   {
+      typedef typename std::decay<F>::type Fn;
+      typedef typename std::result_of<Fn()>::type R;
+      std::shared_ptr<multi::JobResultState<R> > state =
+         std::allocate_shared<multi::JobResultState<R> >(multi::FreeListAllocator<multi::JobResultState<R> >(m_freeList));
+      std::shared_ptr<multiJob> job =
+         m_functionJobPool.create(multi::JobResultSetter<R, Fn>(state, std::forward<F>(f)));
+      add(job);
+      return multi::JobResult<R>(state, job);
+   }
    
    /**
-   * Allows one to remove a job passing in it's name.
+   * Allows one to remove a job passing in it's name.  If several jobs have
+   * the name the one queued first is removed.
    *
    * @param name The job name
    * @return a shared_ptr to the job.  This will be nullptr if not found.
@@ -275,7 +723,8 @@ public:
    virtual std::shared_ptr<multiJob> removeByName(const multiString& name);
 
    /**
-   * Allows one to remove a job passing in it's id.
+   * Allows one to remove a job passing in it's id.  If several jobs have
+   * the id the one queued first is removed.
    *
    * @param id The job id
    * @return a shared_ptr to the job.  This will be nullptr if not found.
@@ -289,13 +738,24 @@ public:
    */
    virtual void remove(const std::shared_ptr<multiJob> Job);
 
+   /**
+   * Takes a queued job off the queue so the caller can run it itself, the
+   * way a fork join parent runs its own children.  Unlike remove no callback
+   * is called since the job is going to run.
+   *
+   * @param job the job to take
+   * @return true if the job was queued and now belongs to the caller
+   */
+   virtual bool claim(const std::shared_ptr<multiJob>& job);
+
    /**
    * Will remove any stopped jobs from the queue
    */
    virtual void removeStoppedJobs();
 
    /**
-   * Will clear the queue
+   * Will clear the queue.  Producers blocked on a full queue are released
+   * without adding their jobs.
    */
    virtual void clear();
 
@@ -311,26 +771,129 @@ public:
    virtual std::shared_ptr<multiJob> nextJob(bool blockIfEmptyFlag=true);
 
    /**
-   * will release the block and have any blocked threads continue
+   * Will grab up to n jobs in dispatch order with a single acquisition of the
+   * queue lock and append them to jobs.  Blocking behaves as in @see nextJob.
+   *
+   * @param n the maximum number of jobs to grab
+   * @param jobs the list the jobs are appended to
+   * @param blockIfEmptyFlag If true it will block the calling thread until more jobs appear
+   *        on the queue.  If false, it will return without blocking
+   * @return the number of jobs appended
+   */
+   virtual std::size_t nextJobs(std::size_t n, multiJob::List& jobs, bool blockIfEmptyFlag=true);
+
+   /**
+   * Gives list nodes back to the queue for reuse by later adds.  A consumer
+   * that takes jobs with nextJobs returns the nodes once it has taken the
+   * jobs out of them, so a steady batched stream does not allocate.  Nodes
+   * past the spare node limit are freed.
+   *
+   * @param nodes the nodes.  Their jobs are released and the list is left
+   *        empty.
+   */
+   virtual void recycleNodes(multiJob::List& nodes);
+
+   /**
+   * Called by a queued job when its priority is changed so it can be
+   * re-positioned.  Does nothing if the job is no longer on the queue.
+   *
+   * @param job the job whose priority changed
+   */
+   virtual void priorityChanged(std::shared_ptr<multiJob> job);
+
+   /**
+   * Called by a queued job when its deadline is changed so it can be
+   * re-positioned.  Does nothing if the job is no longer on the queue.
+   *
+   * @param job the job whose deadline changed
+   */
+   virtual void deadlineChanged(std::shared_ptr<multiJob> job);
+
+   /**
+   * Called by a queued job when its name is changed so the name index can
+   * be updated.  Does nothing if the job is no longer on the queue.
+   *
+   * @param job the job whose name changed
+   */
+   virtual void nameChanged(std::shared_ptr<multiJob> job);
+
+   /**
+   * Called by a queued job when its id is changed so the id index can
+   * be updated.  Does nothing if the job is no longer on the queue.
+   *
+   * @param job the job whose id changed
+   */
+   virtual void idChanged(std::shared_ptr<multiJob> job);
+
+   /**
+   * will release the block and have any blocked consumers continue without a
+   * job.  Producers waiting for space keep waiting.
    */
    virtual void releaseBlock();
 
+   /**
+   * Wakes every producer waiting for space in add, addFor or addAll.  Their
+   * jobs are not queued and add and addFor return false.  Used when the
+   * queue is shut down.  clear calls it.
+   */
+   virtual void releaseProducers();
+
+   /**
+   * Wakes one consumer blocked in nextJob, nextJobs or waitForJobs even if
+   * the queue is empty, so it can look for work kept elsewhere such as the
+   * deque of a work stealing peer.  Unlike releaseBlock nothing stays
+   * released and producers are not touched.
+   */
+   virtual void wakeConsumer();
+
+   /**
+   * Blocks the calling consumer until a job is added or releaseBlock is
+   * called.  Returns immediately if there are jobs or the release flag is
+   * set.  Lets a consumer wait without taking a job.  Queues that keep
+   * their jobs elsewhere override it to wait on their own wakeup.
+   */
+   virtual void waitForJobs();
+
    /**
    * @return true if the queue is empty false otherwise
    */
-   bool isEmpty()const;
+   virtual bool isEmpty()const;
+
+   /**
+   * Reads the number of queued jobs without taking the queue lock.  The
+   * answer may already be stale, so it is only good for deciding whether
+   * polling with nextJob is worth it.  Idle workers spin on it.
+   *
+   * @return true if the queue looked empty
+   */
+   virtual bool isEmptyHint()const;
 
    /**
    * @return the number of jobs on the queue
    */
-   unsigned int size();
+   virtual unsigned int size();
+
+   /**
+   * The queue times are kept in arrival order so this is O(1) whatever
+   * the ordering mode.
+   *
+   * @return how long, in milliseconds, the longest waiting job has been on
+   *         the queue or 0 if the queue is empty
+   */
+   virtual unsigned long long oldestJobWaitMillis();
+
+   /**
+   * @return the number of jobs dropped because their deadline passed before
+   *         they were dispatched
+   */
+   unsigned long long deadlineMissCount()const;
 
    /**
    *  Allows one to set the callback to the list
    *
    * @param c shared_ptr to a callback
    */
-   void setCallback(std::shared_ptr<Callback> c);
+   virtual void setCallback(std::shared_ptr<Callback> c);
 
    /**
    * @return the callback
@@ -339,36 +902,290 @@ public:
    
 protected:
    /**
-   * Internal method that returns an iterator
+   * Jobs are held in bands ordered by key.  Lower keys are dispatched first
+   * and jobs within a band are dispatched in the order they were added.
+   *
+   * The band map and the indexes allocate their nodes from m_freeList so
+   * adding and taking jobs does not go to the heap once the queue has
+   * reached its working size.
+   */
+   typedef std::map<double, multiJob::List, std::less<double>,
+                    multi::FreeListAllocator<std::pair<const double, multiJob::List> > > BandMap;
+
+   /**
+   * Position of a queued job.  band is m_bands.end() if there is no such job.
+   */
+   struct Position
+   {
+      BandMap::iterator        band;
+      multiJob::List::iterator iter;
+   };
+
+   /**
+   * Internal method shared by add, tryAdd and addFor.
+   *
+   * @param job the job to add
+   * @param uniqueFlag if true a job already on the queue is not added
+   * @param waitIfFull if true wait for space when the queue is full
+   * @param deadline if not null the latest time to wait until
+   * @return true if the job was added
+   */
+   bool addJob(std::shared_ptr<multiJob> job,
+               bool uniqueFlag,
+               bool waitIfFull,
+               const std::chrono::steady_clock::time_point* deadline);
+
+   /**
+   * Internal method that notifies the callback and wakes consumers once jobs
+   * were added.
+   *
+   * @param cb the callback or nullptr
+   * @param jobs the jobs that were added
+   */
+   void jobsAdded(std::shared_ptr<Callback> cb, const multiJob::List& jobs);
+
+   /**
+   * @return true if the queue has a capacity and it is used up by queued jobs
+   *         and reserved slots.  Must be called with m_jobQueueMutex held
+   */
+   bool isFull()const;
+
+   /**
+   * Internal method that waits on m_spaceCondition until the queue is not full.
+   *
+   * @param lock holds m_jobQueueMutex
+   * @param waitIfFull if false return immediately
+   * @param deadline if not null the latest time to wait until
+   * @return true if there is space
+   */
+   bool waitForSpace(std::unique_lock<std::mutex>& lock,
+                     bool waitIfFull,
+                     const std::chrono::steady_clock::time_point* deadline);
+
+   /**
+   * Internal method that wakes up to count producers waiting for space.  Must
+   * be called with m_jobQueueMutex held
+   *
+   * @param count the number of slots freed
+   */
+   void notifySpace(std::size_t count);
+
+   /**
+   * Internal method that moves an emptied list node to m_spareNodes, or
+   * frees it once there are enough spare nodes.  Must be called with
+   * m_jobQueueMutex held
+   *
+   * @param list the list holding the node
+   * @param node the node, its job already reset
+   */
+   void keepSpareNode(multiJob::List& list, multiJob::List::iterator node);
+
+   /**
+   * Internal method that points the job back at the queue so it reports
+   * priority, deadline, name and id changes.  Must be called with
+   * m_jobQueueMutex held
+   *
+   * @param job the queued job
+   * @return false if the queue is not owned by a shared_ptr and can not be
+   *         linked to
+   */
+   bool linkJob(const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Internal method that wakes every producer waiting for space and makes
+   * their wait fail.  Must be called with m_jobQueueMutex held
+   */
+   void releaseSpaceWaiters();
+
+   /**
+   * Index entry kept for every queued job.  A job added more than once
+   * without the unique check has an entry for each time.  name and id are
+   * the values the job was indexed under and sequence counts the adds so
+   * the earliest of several entries can be found.
+   */
+   /**
+   * Queue times in the order the jobs were queued, so the front is the
+   * oldest queued job whatever the ordering mode.
+   */
+   typedef std::list<std::chrono::steady_clock::time_point,
+                     multi::FreeListAllocator<std::chrono::steady_clock::time_point> > ArrivalList;
+
+   struct IndexEntry
+   {
+      IndexEntry():tenant(0), linked(false), sequence(0){}
+
+      Position    position;
+      multiString name;
+      multiString id;
+      std::chrono::steady_clock::time_point queuedTime;
+      /** the queue time of the entry in m_arrivals */
+      ArrivalList::iterator arrival;
+      /** index of the job's tenant in m_tenants */
+      std::size_t tenant;
+      /** true if the job points back at the queue through setJobQueue */
+      bool        linked;
+      unsigned long long sequence;
+   };
+   typedef std::unordered_multimap<const multiJob*, IndexEntry,
+                              std::hash<const multiJob*>, std::equal_to<const multiJob*>,
+                              multi::FreeListAllocator<std::pair<const multiJob* const, IndexEntry> > > JobIndex;
+   typedef std::unordered_multimap<multiString, const multiJob*,
+                                   std::hash<multiString>, std::equal_to<multiString>,
+                                   multi::FreeListAllocator<std::pair<const multiString, const multiJob*> > > KeyIndex;
+
+   /**
+   * Internal method that returns the band key for a queued entry of the job
+   * under the current ordering mode.  The entry must have its tenant and
+   * queue time set.
+   *
+   * @param job the job to compute the key for
+   * @param entry the index entry of the job
+   * @return the band key
+   */
+   double bandKey(const std::shared_ptr<multiJob>& job, const IndexEntry& entry)const;
+
+   /**
+   * Internal method that returns the index of the tenant in m_tenants,
+   * adding it if needed.  Must be called with m_jobQueueMutex held
+   *
+   * @param tenant the tenant
+   * @return the index
+   */
+   std::size_t tenantIndex(const multiString& tenant);
+
+   /**
+   * Internal method that returns the band the next job is taken from.  That
+   * is the first band except in FAIR_SHARE_ORDERING where the bands, one per
+   * tenant, take turns.  The queue must not be empty.  Must be called with
+   * m_jobQueueMutex held
+   *
+   * @return the band
+   */
+   BandMap::iterator nextBand();
+
+   /**
+   * Internal method that moves a queued job to the band for its current key.
+   * It is placed by queue order within the band so the head of every band
+   * stays its oldest job.  Must be called with m_jobQueueMutex held
+   *
+   * @param job the job
+   */
+   void rebandJob(const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Internal method that moves every queued job to the band for its current
+   * key, keeping queue order within the bands.  Must be called with
+   * m_jobQueueMutex held
+   */
+   void rebandAll();
+
+   /**
+   * Internal method that appends the job to the band for its key.  Must be
+   * called with m_jobQueueMutex held
+   *
+   * @param job the job to queue
+   */
+   void pushJob(const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Internal method that removes the job from the id and name indexes.
+   * Must be called with m_jobQueueMutex held
+   *
+   * @param job the job
+   * @param entry the job's index entry
+   */
+   void unindexKeys(const multiJob* job, const IndexEntry& entry);
+
+   /**
+   * Internal method that removes a single key to job mapping.
+   *
+   * @param index the index to remove from
+   * @param key the key the job was indexed under
+   * @param job the job
+   */
+   static void eraseKey(KeyIndex& index, const multiString& key, const multiJob* job);
+
+   /**
+   * Internal method that removes the job at the position, dropping the band
+   * if it becomes empty.  Must be called with m_jobQueueMutex held
+   *
+   * @param pos the position of the job
+   * @param dest if not null the job's list node is spliced onto the end of
+   *        dest instead of being freed
+   * @return the removed job
+   */
+   std::shared_ptr<multiJob> eraseJob(const Position& pos, multiJob::List* dest=0);
+
+   /**
+   * Internal method that removes the next job in dispatch order and appends
+   * it to jobs.  Canceled jobs found on the way are marked finished and
+   * dropped.  Jobs whose deadline has passed are canceled, counted as missed
+   * and dropped the same way.  Must be called with m_jobQueueMutex held
+   *
+   * @param jobs list the job is appended to
+   * @return true if a job was appended
+   */
+   virtual bool popJob(multiJob::List& jobs);
+
+   /**
+   * Internal method that returns the index entry of a queued list node
+   *
+   * @param node the list node holding the job
+   * @return the entry or m_jobIndex.end()
+   */
+   JobIndex::iterator findEntry(const multiJob::List::iterator& node);
+
+   /**
+   * Internal method that returns the earliest queued entry of a job
+   *
+   * @param job the job to search for
+   * @return the entry or m_jobIndex.end()
+   */
+   JobIndex::iterator earliestEntry(const multiJob* job);
+
+   /**
+   * Internal method that returns the earliest queued job of a key index
+   *
+   * @param index the id or the name index
+   * @param key the id or name to search for
+   * @return the position
+   */
+   Position findByKey(const KeyIndex& index, const multiString& key);
+
+   /**
+   * Internal method that returns a position using the id index.  Of several
+   * jobs with the id the one queued first is returned.
    *
    * @param the id of the job to search for
-   * @return the iterator
+   * @return the position
    */
-   multiJob::List::iterator findById(const multiString& id);
+   Position findById(const multiString& id);
 
    /**
-   * Internal method that returns an iterator
+   * Internal method that returns a position using the name index.  Of
+   * several jobs with the name the one queued first is returned.
    *
    * @param name the name of the job to search for
-   * @return the iterator
+   * @return the position
    */
-   multiJob::List::iterator findByName(const multiString& name);
+   Position findByName(const multiString& name);
 
    /**
-   * Internal method that returns an iterator
+   * Internal method that returns a position using the pointer index.  A job
+   * queued more than once is found at its earliest position.
    *
    * @param job the job to search for
-   * @return the iterator
+   * @return the position
    */
-   multiJob::List::iterator findByPointer(const std::shared_ptr<multiJob> job);
+   Position findByPointer(const std::shared_ptr<multiJob> job);
 
    /**
-   * Internal method that returns an iterator
+   * Internal method that returns a position
    * 
    * @param job it will find by the name or by the pointer
-   * @return the iterator
+   * @return the position
    */
-   multiJob::List::iterator findByNameOrPointer(const std::shared_ptr<multiJob> job);
+   Position findByNameOrPointer(const std::shared_ptr<multiJob> job);
 
    /**
    * Internal method that determines if we have the job
@@ -378,9 +1195,85 @@ protected:
    bool hasJob(std::shared_ptr<multiJob> job);
    
    mutable std::mutex m_jobQueueMutex;
-   multi::Block m_block;
-   multiJob::List m_jobQueue;
+
+   /**
+   * Consumers blocked in nextJob wait here.  Each added job wakes one of them
+   * and releaseBlock wakes them all and sets m_releaseFlag until a consumer
+   * finds the queue empty.
+   */
+   multi::EventCount m_jobEvent;
+   std::atomic<bool> m_releaseFlag;
+   OrderingMode m_orderingMode;
+   std::shared_ptr<multi::FreeList> m_freeList;
+   BandMap m_bands;
+   JobIndex m_jobIndex;
+   KeyIndex m_idIndex;
+   KeyIndex m_nameIndex;
+   ArrivalList m_arrivals;
+
+   /**
+   * Empty list nodes kept for reuse by pushJob.  Jobs leaving the queue give
+   * their node back here, up to the capacity or 1024 nodes if that is more.
+   */
+   multiJob::List m_spareNodes;
+
+   /**
+   * Recycles the jobs made by submit
+   */
+   multi::JobPool<multiFunctionJob> m_functionJobPool;
    std::shared_ptr<Callback> m_callback;
+
+   /**
+   * Bounded queue state.  m_reservedCount counts slots claimed by add calls that
+   * released the lock to run the adding callback.  m_spaceReleaseCount is
+   * bumped by releaseSpaceWaiters so producers know their wait was released.
+   */
+   std::size_t m_capacity;
+   std::size_t m_reservedCount;
+   std::size_t m_spaceWaitCount;
+   std::size_t m_spaceReleaseCount;
+   std::condition_variable m_spaceCondition;
+
+   /**
+   * Jobs dropped because their deadline passed
+   */
+   std::atomic<unsigned long long> m_deadlineMissCount;
+
+   /**
+   * Copy of the number of queued jobs for isEmptyHint.  Written with
+   * m_jobQueueMutex held, read without it.
+   */
+   std::atomic<std::size_t> m_jobCount;
+
+   /**
+   * Handed to linked jobs.  Set by linkJob the first time it is needed.
+   */
+   std::weak_ptr<multiJobQueue> m_self;
+
+   /**
+   * Sequence given to the next index entry
+   */
+   unsigned long long m_sequence;
+
+   /**
+   * Tenant counters indexed by the band key used in FAIR_SHARE_ORDERING.
+   * Index 0 is the default tenant.
+   */
+   std::vector<TenantStats>                     m_tenants;
+   std::unordered_map<multiString, std::size_t> m_tenantIndex;
+
+   /**
+   * The tenant whose turn it is and the jobs it has left in the turn
+   */
+   std::size_t  m_fairTenant;
+   unsigned int m_fairCredit;
+
+   /**
+   * Priority gained per second queued and the longest wait seen per priority
+   */
+   double                               m_priorityAging;
+   std::map<double, unsigned long long> m_maxWaitMillis;
+   std::vector<double>                  m_waitStatsBands;
 };
 
 #endif
@@ -0,0 +1,314 @@
+#ifndef multiJobResult_HEADER
+#define multiJobResult_HEADER
+#include <multiJob.h>
+#include <Thread.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+
+namespace multi{
+
+   /**
+   * Thrown by JobResult::get when the job was released without being run,
+   * for example because it was canceled or removed from its queue.
+   */
+   class OSSIM_DLL JobNotRun : public std::runtime_error
+   {
+   public:
+      JobNotRun():std::runtime_error("job was released without being run"){}
+   };
+
+   /**
+   * Shared completion state behind a JobResult.  Holds the exception and the
+   * continuations.  Completing the state wakes only the threads waiting on
+   * this result.
+   */
+   class OSSIM_DLL JobResultStateBase
+   {
+   public:
+      JobResultStateBase();
+      virtual ~JobResultStateBase();
+
+      /**
+      * @return true once a value or exception has been set
+      */
+      bool isReady()const{return m_ready.load(std::memory_order_acquire);}
+
+      /**
+      * Blocks until the state is ready
+      */
+      void wait();
+
+      /**
+      * Blocks until the state is ready or the time has elapsed
+      *
+      * @param waitTimeMillis the maximum time to wait in milliseconds
+      * @return true if ready
+      */
+      bool waitFor(unsigned long long waitTimeMillis);
+
+      /**
+      * Completes the state with an exception.  Does nothing if already ready.
+      *
+      * @param exception the exception to hand to the waiters
+      */
+      void setException(std::exception_ptr exception);
+
+      /**
+      * @return the exception or nullptr.  Only valid once ready
+      */
+      std::exception_ptr exception()const{return m_exception;}
+
+      /**
+      * Calls continuation once the state is ready.  Calls it right away on
+      * the calling thread if it is already ready, otherwise on the thread that
+      * completes the state.
+      *
+      * @param continuation the function to call
+      */
+      void addContinuation(std::function<void()> continuation);
+
+   protected:
+      /**
+      * Marks the state ready, wakes the waiters and runs the continuations.
+      * Must be called with lock holding m_mutex and will release it.
+      */
+      void complete(std::unique_lock<std::mutex>& lock);
+
+      mutable std::mutex      m_mutex;
+      std::condition_variable m_condition;
+      std::atomic<bool>       m_ready;
+      int                     m_waitCount;
+      std::exception_ptr      m_exception;
+      std::vector<std::function<void()> > m_continuations;
+   };
+
+   /**
+   * Completion state holding a value of type T.
+   */
+   template<class T>
+   class JobResultState : public JobResultStateBase
+   {
+   public:
+      typedef const T& ValueType;
+
+      JobResultState():m_hasValue(false){}
+      virtual ~JobResultState()
+      {
+         if(m_hasValue) reinterpret_cast<T*>(&m_storage)->~T();
+      }
+
+      /**
+      * Completes the state with a value.  Does nothing if already ready.
+      */
+      template<class V>
+      void setValue(V&& value)
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if(m_ready.load(std::memory_order_relaxed)) return;
+         new(&m_storage) T(std::forward<V>(value));
+         m_hasValue = true;
+         complete(lock);
+      }
+
+      /**
+      * @return the value.  Only valid once ready without an exception
+      */
+      ValueType value()const{return *reinterpret_cast<const T*>(&m_storage);}
+
+   private:
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+      bool m_hasValue;
+   };
+
+   /**
+   * Completion state of a job with no value.
+   */
+   template<>
+   class JobResultState<void> : public JobResultStateBase
+   {
+   public:
+      typedef void ValueType;
+
+      void setValue()
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if(m_ready.load(std::memory_order_relaxed)) return;
+         complete(lock);
+      }
+      void value()const{}
+   };
+
+   /**
+   * Calls a callable with no arguments and stores its result, or the
+   * exception it throws, in a JobResultState.
+   */
+   template<class R>
+   struct JobResultInvoker
+   {
+      template<class F>
+      static void invoke(JobResultState<R>& state, F& f){state.setValue(f());}
+   };
+   template<>
+   struct JobResultInvoker<void>
+   {
+      template<class F>
+      static void invoke(JobResultState<void>& state, F& f){f(); state.setValue();}
+   };
+
+   /**
+   * Future like handle to the result of a job.  Handles are cheap to copy and
+   * all copies see the same result.  A handle does not keep its job alive.
+   *
+   * @code
+   * multi::JobResult<int> result = jobQueue->submit([]{ return 42; });
+   * multi::JobResult<void> printed = result.then([](multi::JobResult<int> r){
+   *    std::cout << r.get() << "\n";
+   * });
+   * printed.wait();
+   * @endcode
+   */
+   template<class T>
+   class JobResult
+   {
+   public:
+      typedef JobResultState<T> State;
+
+      JobResult(){}
+      JobResult(std::shared_ptr<State> state, std::weak_ptr<multiJob> job=std::weak_ptr<multiJob>())
+      :m_state(state),
+       m_job(job)
+      {}
+
+      /**
+      * @return true if the handle refers to a result
+      */
+      bool valid()const{return (m_state != nullptr);}
+
+      /**
+      * @return true if the value or exception is available
+      */
+      bool isReady()const{return m_state->isReady();}
+
+      /**
+      * Blocks until the result is available
+      */
+      void wait()const{m_state->wait();}
+
+      /**
+      * Blocks until the result is available or the time has elapsed
+      *
+      * @param waitTimeMillis the maximum time to wait in milliseconds
+      * @return true if the result is available
+      */
+      bool waitFor(unsigned long long waitTimeMillis)const{return m_state->waitFor(waitTimeMillis);}
+
+      /**
+      * Waits for and returns the result.  Rethrows the exception thrown by
+      * the job or JobNotRun if the job was released without running.
+      *
+      * @return the value returned by the job
+      */
+      typename State::ValueType get()const
+      {
+         m_state->wait();
+         if(m_state->exception()) std::rethrow_exception(m_state->exception());
+         return m_state->value();
+      }
+
+      /**
+      * Calls f with this result once it is available and returns a handle to
+      * what f returns.  f is called on the thread that completes the result,
+      * or right away if it is already available.  An exception thrown by f is
+      * passed on to the returned handle.
+      *
+      * @param f callable taking a JobResult<T>
+      * @return the result of f
+      */
+      template<class F>
+      JobResult<typename std::result_of<F(JobResult<T>)>::type> then(F f)const
+      {
+         typedef typename std::result_of<F(JobResult<T>)>::type R;
+         std::shared_ptr<JobResultState<R> > next = std::make_shared<JobResultState<R> >();
+         JobResult<T> self = *this;
+         m_state->addContinuation([self, next, f]() mutable {
+            try
+            {
+               auto call = [&self, &f]{return f(self);};
+               JobResultInvoker<R>::invoke(*next, call);
+            }
+            catch(...)
+            {
+               next->setException(std::current_exception());
+            }
+         });
+         return JobResult<R>(next);
+      }
+
+      /**
+      * @return the job or nullptr if it no longer exists
+      */
+      std::shared_ptr<multiJob> job()const{return m_job.lock();}
+
+   private:
+      std::shared_ptr<State>  m_state;
+      std::weak_ptr<multiJob> m_job;
+   };
+
+   /**
+   * Callable stored in the job made by multiJobQueue::submit.  It runs the
+   * user callable and stores the result.  If it is destroyed without having
+   * run the result is completed with JobNotRun so waiters do not hang.
+   */
+   template<class R, class F>
+   class JobResultSetter
+   {
+   public:
+      template<class G>
+      JobResultSetter(std::shared_ptr<JobResultState<R> > state, G&& f)
+      :m_state(state),
+       m_f(std::forward<G>(f))
+      {}
+      JobResultSetter(JobResultSetter&& src)
+      :m_state(std::move(src.m_state)),
+       m_f(std::move(src.m_f))
+      {}
+      ~JobResultSetter()
+      {
+         if(m_state&&!m_state->isReady())
+         {
+            m_state->setException(std::make_exception_ptr(JobNotRun()));
+         }
+      }
+      void operator()()
+      {
+         try
+         {
+            JobResultInvoker<R>::invoke(*m_state, m_f);
+         }
+         catch(multi::Thread::Interrupt&)
+         {
+            // the job was not run to the end.  The result reports JobNotRun
+            // once the job is released.
+            throw;
+         }
+         catch(...)
+         {
+            // the job keeps the exception too
+            m_state->setException(std::current_exception());
+            throw;
+         }
+      }
+
+   private:
+      std::shared_ptr<JobResultState<R> > m_state;
+      F m_f;
+   };
+}
+
+#endif
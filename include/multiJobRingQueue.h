@@ -0,0 +1,334 @@
+//**************************************************************************************************
+//                          OSSIM -- Open Source Software Image Map
+//
+// LICENSE: See top level LICENSE.txt file.
+//
+//**************************************************************************************************
+//  $Id$
+#ifndef multiJobRingQueue_HEADER
+#define multiJobRingQueue_HEADER
+
+#include <multiJobQueue.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+/**
+* multiJobRingQueue is a fixed capacity job queue backed by a lock-free
+* multi-producer multi-consumer ring of sequence numbered slots (D. Vyukov's
+* bounded MPMC queue).  add, tryAdd, nextJob and nextJobs do not take a lock
+* unless a thread has to sleep because the ring is empty or full, so it can be
+* used anywhere a multiJobQueue is expected, for example by multiJobThreadQueue.
+*
+* The ring is FIFO, only jobs that addAll had to put past the capacity jump
+* ahead.  Since it keeps no index, jobs cannot be removed by id, name or
+* pointer and duplicates are not detected.  The ordering mode and capacity are
+* fixed at construction.  Jobs whose deadline has passed are still dropped
+* when they reach the head.
+*
+* @code
+* std::shared_ptr<multiJobQueue> jobQueue = std::make_shared<multiJobRingQueue>(4096);
+* std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(jobQueue, 8);
+* jobQueue->add(std::make_shared<TestJob>());
+* @endcode
+*/
+class OSSIM_DLL multiJobRingQueue : public multiJobQueue
+{
+public:
+   /**
+   * @param capacity number of slots.  Rounded up to a power of 2.
+   */
+   multiJobRingQueue(std::size_t capacity=1024);
+
+   /**
+   * Destructor.  Releases any jobs still on the ring.
+   */
+   virtual ~multiJobRingQueue();
+
+   /**
+   * Adds the job blocking while the ring is full.
+   *
+   * @param job The job to add to the queue.
+   * @param guaranteeUniqueFlag ignored.  The ring does not detect duplicates.
+   * @return false if the wait for a slot was ended by releaseProducers or
+   *         clear
+   */
+   virtual bool add(std::shared_ptr<multiJob> job, bool guaranteeUniqueFlag=true);
+
+   /**
+   * @param job The job to add to the queue.
+   * @return false if the ring is full
+   */
+   virtual bool tryAdd(std::shared_ptr<multiJob> job);
+
+   /**
+   * @param job The job to add to the queue.
+   * @param waitTimeMillis the maximum time to wait for a free slot in milliseconds
+   * @return false if the ring stayed full
+   */
+   virtual bool addFor(std::shared_ptr<multiJob> job, unsigned long long waitTimeMillis);
+
+   /**
+   * Adds the jobs one slot at a time, blocking while the ring is full unless
+   * ignoreCapacity is set.  Then the jobs that do not fit are kept on an
+   * overflow list that consumers drain ahead of the ring, so jobs already
+   * admitted elsewhere, like continuations added by a worker, are never
+   * dropped.  The callback is notified through addingBatch and addedBatch
+   * once for each part of the batch that got slots, and a job is only made
+   * ready once it has a slot, so jobs left out by releaseProducers or clear
+   * are untouched.
+   *
+   * @param jobs The jobs to add to the queue.
+   * @param ignoreCapacity if true never block
+   * @return the number of jobs queued.  Short if the wait for a slot was
+   *         ended by releaseProducers or clear.
+   */
+   virtual std::size_t addAll(const multiJob::List& jobs, bool ignoreCapacity=false);
+
+   /**
+   * Not supported by the ring.
+   *
+   * @return nullptr
+   */
+   virtual std::shared_ptr<multiJob> removeByName(const multiString& name);
+
+   /**
+   * Not supported by the ring.
+   *
+   * @return nullptr
+   */
+   virtual std::shared_ptr<multiJob> removeById(const multiString& id);
+
+   /**
+   * Not supported by the ring.
+   */
+   virtual void remove(const std::shared_ptr<multiJob> job);
+
+   /**
+   * Jobs can not be taken out of the middle of the ring.
+   *
+   * @return false
+   */
+   virtual bool claim(const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Does nothing.  Jobs on the ring are never stopped since canceled jobs
+   * are dropped as they are dequeued.
+   */
+   virtual void removeStoppedJobs();
+
+   /**
+   * Will drain the ring and the overflow list.  Producers blocked on the full
+   * ring are released without adding their jobs.
+   */
+   virtual void clear();
+
+   /**
+   * @see multiJobQueue::nextJob
+   */
+   virtual std::shared_ptr<multiJob> nextJob(bool blockIfEmptyFlag=true);
+
+   /**
+   * @see multiJobQueue::nextJobs
+   */
+   virtual std::size_t nextJobs(std::size_t n, multiJob::List& jobs, bool blockIfEmptyFlag=true);
+
+   /**
+   * Keeps up to the ring capacity of nodes for nextJobs to fill.
+   * @see multiJobQueue::recycleNodes
+   */
+   virtual void recycleNodes(multiJob::List& nodes);
+
+   /**
+   * Wakes every thread blocked in nextJob, nextJobs or waitForJobs.
+   * Producers waiting for a slot keep waiting.
+   */
+   virtual void releaseBlock();
+
+   /**
+   * Wakes every producer waiting for a slot.  Their jobs are not added.
+   * @see multiJobQueue::releaseProducers
+   */
+   virtual void releaseProducers();
+
+   /**
+   * @see multiJobQueue::wakeConsumer
+   */
+   virtual void wakeConsumer();
+
+   /**
+   * Blocks until a job is put on the ring or releaseBlock is called.
+   * @see multiJobQueue::waitForJobs
+   */
+   virtual void waitForJobs();
+
+   /**
+   * @return true if the ring and the overflow list are empty.  Approximate
+   *         while other threads are adding or removing.
+   */
+   virtual bool isEmpty()const;
+
+   /**
+   * The ring is checked without a lock already.
+   *
+   * @return isEmpty()
+   */
+   virtual bool isEmptyHint()const;
+
+   /**
+   * @return the number of jobs on the ring and the overflow list.
+   *         Approximate while other threads are adding or removing.
+   */
+   virtual unsigned int size();
+
+   /**
+   * The ring does not record when jobs were added.
+   *
+   * @return 0
+   */
+   virtual unsigned long long oldestJobWaitMillis();
+
+   /**
+   * The ring only supports FIFO_ORDERING.  Does nothing.
+   */
+   virtual void setOrderingMode(OrderingMode mode);
+
+   /**
+   * The ring capacity is fixed at construction.  Does nothing.
+   */
+   virtual void setCapacity(std::size_t capacity);
+
+   /**
+   * @return the number of slots
+   */
+   virtual std::size_t capacity()const;
+
+   /**
+   * @param c shared_ptr to a callback
+   */
+   virtual void setCallback(std::shared_ptr<Callback> c);
+
+protected:
+   enum
+   {
+      CACHE_LINE_SIZE = 64
+   };
+
+   /**
+   * A slot is filled when its sequence equals the enqueue position + 1 and
+   * free when it equals the enqueue position.  Each slot fills a cache line.
+   */
+   struct Slot
+   {
+      std::atomic<std::size_t>  m_sequence;
+      std::shared_ptr<multiJob> m_job;
+      char m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>) - sizeof(std::shared_ptr<multiJob>)];
+   };
+
+   /**
+   * Internal lock-free enqueue.
+   *
+   * @return false if the ring is full
+   */
+   bool enqueue(const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Internal method that takes the next free slot without filling it.
+   * Consumers stop at the slot until publish is called for it.
+   *
+   * @param pos set to the position of the slot
+   * @return false if the ring is full
+   */
+   bool claimSlot(std::size_t& pos);
+
+   /**
+   * Internal method that fills a slot taken by claimSlot.
+   */
+   void publish(std::size_t pos, const std::shared_ptr<multiJob>& job);
+
+   /**
+   * Internal lock-free dequeue.
+   *
+   * @return the job or nullptr if the ring is empty
+   */
+   std::shared_ptr<multiJob> dequeue();
+
+   /**
+   * Internal method that takes the oldest job from the overflow list.
+   *
+   * @return the job or nullptr if the list is empty
+   */
+   std::shared_ptr<multiJob> dequeueOverflow();
+
+   /**
+   * Internal method that dequeues skipping canceled jobs and dropping jobs
+   * whose deadline has passed.  The overflow list is drained first.
+   */
+   std::shared_ptr<multiJob> dequeueReady();
+
+   /**
+   * Internal method that adds a single job waiting for a free slot if needed.
+   * The slot is taken before the adding callback and the ready state change
+   * so a job that does not fit is left untouched.
+   *
+   * @param job the job to add
+   * @param waitIfFull if true wait for a free slot
+   * @param deadline if not null the latest time to wait until
+   * @return true if the job was added
+   */
+   bool addToRing(const std::shared_ptr<multiJob>& job,
+                  bool waitIfFull,
+                  const std::chrono::steady_clock::time_point* deadline);
+
+   /**
+   * Internal method that wakes a sleeping consumer if there is one
+   */
+   void notifyConsumer();
+
+   /**
+   * Internal method that wakes a sleeping producer if there is one
+   */
+   void notifyProducer();
+
+   char*                    m_slotBuffer;
+   Slot*                    m_slots;
+   std::size_t              m_mask;
+   char                     m_pad0[CACHE_LINE_SIZE];
+   std::atomic<std::size_t> m_enqueuePos;
+   char                     m_pad1[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+   std::atomic<std::size_t> m_dequeuePos;
+   char                     m_pad2[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+
+   /**
+   * Slow path state used only when a consumer finds the ring empty or a
+   * producer finds it full.
+   */
+   std::mutex               m_waitMutex;
+   std::condition_variable  m_consumerCondition;
+   std::condition_variable  m_producerCondition;
+   std::atomic<int>         m_consumerWaitCount;
+   std::atomic<int>         m_producerWaitCount;
+   std::atomic<unsigned>    m_releaseCount;
+   std::atomic<unsigned>    m_wakeCount;
+   std::atomic<unsigned>    m_spaceReleaseCount;
+   std::atomic<bool>        m_released;
+   std::atomic<bool>        m_hasCallback;
+
+   /**
+   * Jobs added with ignoreCapacity while the ring was full.  The count lets
+   * consumers skip the lock while the list is empty.
+   */
+   std::mutex               m_overflowMutex;
+   multiJob::List           m_overflow;
+   std::atomic<std::size_t> m_overflowCount;
+
+   /**
+   * Empty list nodes handed back through recycleNodes.  nextJobs fills them
+   * so batches taken from the ring do not allocate.
+   */
+   std::mutex               m_spareMutex;
+   multiJob::List           m_spareBatchNodes;
+};
+
+#endif
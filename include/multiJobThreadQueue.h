@@ -3,6 +3,186 @@
 #include <multiJobQueue.h>
 #include <Thread.h>
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace multi{
+
+   /**
+   * WorkStealingDeque is a Chase-Lev work stealing deque of jobs.  The owning
+   * thread pushes and takes jobs at the bottom without locking while any other
+   * thread may steal from the top.  Jobs are held by a boxed shared_ptr so the
+   * slots can be exchanged atomically.  Boxes are recycled: the owner keeps
+   * the boxes it takes and thieves hand theirs back on a lock-free list, so
+   * once the deque has seen its peak depth push does not allocate.
+   *
+   * Only the owner may call push and take.  steal, isEmpty and size are safe from
+   * any thread.
+   *
+   * @code
+   * std::shared_ptr<multi::WorkStealingDeque> deque = std::make_shared<multi::WorkStealingDeque>();
+   * // owner thread
+   * deque->push(job);
+   * std::shared_ptr<multiJob> mine = deque->take();
+   * // any other thread
+   * std::shared_ptr<multiJob> stolen = deque->steal();
+   * @endcode
+   */
+   class OSSIM_DLL WorkStealingDeque
+   {
+   public:
+      /**
+      * @param capacity initial capacity.  Rounded up to a power of 2.  The deque
+      *        grows when full.
+      */
+      WorkStealingDeque(std::int64_t capacity=64);
+
+      /**
+      * Destructor.  Releases any jobs still on the deque.
+      */
+      ~WorkStealingDeque();
+
+      /**
+      * Pushes a job to the bottom.  Owner only.
+      *
+      * @param job the job to push
+      */
+      void push(std::shared_ptr<multiJob> job);
+
+      /**
+      * Takes the most recently pushed job from the bottom.  Owner only.
+      *
+      * @return the job or nullptr if the deque is empty
+      */
+      std::shared_ptr<multiJob> take();
+
+      /**
+      * Steals the oldest job from the top.  Returns nullptr if the deque is
+      * empty or if another thread won the race for the job.
+      *
+      * @return the stolen job or nullptr
+      */
+      std::shared_ptr<multiJob> steal();
+
+      /**
+      * @return true if the deque is empty
+      */
+      bool isEmpty()const;
+
+      /**
+      * @return approximate number of jobs on the deque
+      */
+      std::int64_t size()const;
+
+   private:
+      /**
+      * Holds a job on the deque.  m_next links free boxes.
+      */
+      struct JobBox
+      {
+         JobBox():m_next(0){}
+
+         std::shared_ptr<multiJob> m_job;
+         JobBox*                   m_next;
+      };
+      typedef JobBox* Box;
+
+      /**
+      * Circular buffer of boxes.  Buffers are never freed while the deque is
+      * alive since a thief may still be reading a replaced buffer.
+      */
+      struct Buffer
+      {
+         Buffer(std::int64_t capacity);
+         ~Buffer();
+         Box  get(std::int64_t idx)const{return m_slots[idx&m_mask].load(std::memory_order_relaxed);}
+         void put(std::int64_t idx, Box b){m_slots[idx&m_mask].store(b, std::memory_order_relaxed);}
+
+         std::int64_t       m_capacity;
+         std::int64_t       m_mask;
+         std::atomic<Box>*  m_slots;
+      };
+
+      /**
+      * Doubles the buffer copying the live range [top, bottom).  Owner only.
+      */
+      Buffer* grow(Buffer* buffer, std::int64_t top, std::int64_t bottom);
+
+      /**
+      * Returns a free box holding the job.  Owner only.
+      */
+      Box allocateBox(const std::shared_ptr<multiJob>& job);
+
+      /**
+      * Hands a box a thief emptied back to the owner.
+      */
+      void returnBox(Box box);
+
+      /**
+      * Deletes a list of boxes linked through m_next
+      */
+      static void deleteBoxes(Box box);
+
+      std::atomic<std::int64_t> m_top;
+      std::atomic<std::int64_t> m_bottom;
+      std::atomic<Buffer*>      m_buffer;
+      std::vector<Buffer*>      m_retiredBuffers;
+
+      /**
+      * Free boxes.  m_freeBoxes is used by the owner only and is refilled
+      * from m_returnedBoxes, where thieves push the boxes they emptied.
+      */
+      Box                       m_freeBoxes;
+      std::atomic<Box>          m_returnedBoxes;
+   };
+
+   /**
+   * IdlePolicy controls what a job thread does when it runs out of work.  It
+   * first spins for up to spinMicros polling for work with a pause instruction
+   * between polls, then yields for up to yieldMicros and then parks on the job
+   * queue until a job is added.  Polls read multiJobQueue::isEmptyHint and
+   * only take the queue lock once it reports jobs.
+   *
+   * If adaptive the thread keeps a moving average of how long it stays idle.
+   * When the average is longer than the spin and yield budget the thread parks
+   * right away so an idle pool does not burn a core, and it starts spinning
+   * again once jobs arrive closer together.
+   *
+   * @code
+   * // never spin
+   * threadQueue->setIdlePolicy(multi::IdlePolicy(0, 0));
+   * // spin up to 100 microseconds and yield up to 1 millisecond
+   * threadQueue->setIdlePolicy(multi::IdlePolicy(100, 1000));
+   * @endcode
+   */
+   class OSSIM_DLL IdlePolicy
+   {
+   public:
+      /**
+      * @param spinMicros maximum time to spin before yielding
+      * @param yieldMicros maximum time to yield before parking
+      * @param adaptiveFlag if true skip the spin and yield when the thread
+      *        is usually idle for longer than both
+      */
+      IdlePolicy(unsigned long long spinMicros=50,
+                 unsigned long long yieldMicros=50,
+                 bool adaptiveFlag=true)
+      :m_spinMicros(spinMicros),
+       m_yieldMicros(yieldMicros),
+       m_adaptive(adaptiveFlag)
+      {}
+
+      unsigned long long spinMicros()const{return m_spinMicros;}
+      unsigned long long yieldMicros()const{return m_yieldMicros;}
+      bool isAdaptive()const{return m_adaptive;}
+
+   private:
+      unsigned long long m_spinMicros;
+      unsigned long long m_yieldMicros;
+      bool               m_adaptive;
+   };
+}
 
 /**
 * multiJobThreadQueue allows one to instantiate a thread with a shared
@@ -126,6 +306,27 @@ public:
    */
    virtual void cancel();
 
+   /**
+   * Asks the thread to stop and returns without waiting.  Use waitForStop to
+   * wait.  Lets several threads be stopped at the same time.
+   *
+   * @param cancelCurrentJobFlag if true the running job is canceled.  If false
+   *        the running job is allowed to finish and a job that was taken but
+   *        not started is put back on the shared queue.
+   */
+   void stop(bool cancelCurrentJobFlag=true);
+
+   /**
+   * Waits for a thread that was asked to stop to leave its run loop.
+   */
+   void waitForStop();
+
+   /**
+   * @return the number of milliseconds since the thread last finished a job
+   *         or was created.  0 while a job is being processed.
+   */
+   unsigned long long idleMillis()const;
+
    /**
    * @return true if the queue is empty
    *         false otherwise.
@@ -143,6 +344,115 @@ public:
    *         false otherwise.
    */
    bool hasJobsToProcess()const;
+
+   /**
+   * Sets an event that is notified each time the thread runs out of work
+   * and is about to block.  Used by multiJobMultiThreadQueue::waitForIdle.
+   *
+   * @param idleEvent the event or nullptr
+   */
+   void setIdleEvent(std::shared_ptr<multi::EventCount> idleEvent);
+
+   typedef std::vector<std::shared_ptr<multi::WorkStealingDeque> > DequeList;
+
+   /**
+   * Enables work stealing for this thread.  Jobs pushed with pushLocal go to
+   * the local deque.  When the local deque is empty the thread pulls from the
+   * shared job queue and then steals from the peer deques before blocking.
+   *
+   * @param localDeque deque owned by this thread.  nullptr disables work stealing
+   * @param peers deques to steal from.  May include localDeque.
+   */
+   void setWorkStealing(std::shared_ptr<multi::WorkStealingDeque> localDeque,
+                        std::shared_ptr<const DequeList> peers);
+
+   /**
+   * Replaces the deques this thread steals from.
+   *
+   * @param peers deques to steal from
+   */
+   void setStealPeers(std::shared_ptr<const DequeList> peers);
+
+   /**
+   * @return the local deque or nullptr if work stealing is disabled
+   */
+   std::shared_ptr<multi::WorkStealingDeque> localDeque()const;
+
+   /**
+   * Pushes a job onto the local deque.  Must be called from this thread.
+   *
+   * @param job the job to push
+   * @return false if work stealing is disabled or the caller is not this thread
+   */
+   bool pushLocal(std::shared_ptr<multiJob> job);
+
+   /**
+   * Runs one job that is waiting for this thread without blocking.  Looks at
+   * the local deque first, so a fork join parent runs its newest children,
+   * then the batch, the shared queue and the peers.  Must be called from
+   * this thread, normally by a job that is waiting for other jobs.
+   *
+   * @return true if a job was run
+   */
+   bool runPendingJob();
+
+   /**
+   * Sets the number of jobs claimed from the shared queue per lock
+   * acquisition.  The claimed jobs are run from a local batch before going back
+   * to the shared queue.  Canceled jobs in the batch are skipped and, if the
+   * thread is canceled, unstarted jobs are returned to the shared queue.
+   * The list nodes of a batch are handed back with
+   * multiJobQueue::recycleNodes before the next claim.
+   *
+   * @param batchSize number of jobs per claim.  1 fetches a job at a time.
+   */
+   void setBatchSize(std::size_t batchSize);
+
+   /**
+   * @return the number of jobs claimed per lock acquisition
+   */
+   std::size_t batchSize()const;
+
+   /**
+   * Sets what the thread does when it runs out of work.  @see multi::IdlePolicy
+   *
+   * @param policy the idle policy
+   */
+   void setIdlePolicy(const multi::IdlePolicy& policy);
+
+   /**
+   * @return the idle policy
+   */
+   multi::IdlePolicy idlePolicy()const;
+
+   /**
+   * @return the multiJobThreadQueue running on the calling thread or nullptr
+   *         if the calling thread is not a job thread
+   */
+   static multiJobThreadQueue* currentThreadQueue();
+
+   /**
+   * Sets the NUMA node this thread is pinned to.  Used by pools that pin
+   * their threads.  @see currentNumaNode
+   *
+   * @param node the node id or -1 if unknown
+   */
+   void setNumaNode(int node);
+
+   /**
+   * @return the NUMA node this thread is pinned to or -1 if unknown
+   */
+   int numaNode()const;
+
+   /**
+   * Lets a running job find the NUMA node the thread it runs on is pinned
+   * to.  This only describes the thread.  Jobs come from a shared queue, so
+   * memory the job touches may live on any node.
+   *
+   * @return the NUMA node of the calling job thread or -1 if the calling
+   *         thread is not a job thread or is not pinned within one node
+   */
+   static int currentNumaNode();
    
 protected:
    /**
@@ -155,11 +465,99 @@ protected:
    * Will return the next job on the queue
    */
    virtual std::shared_ptr<multiJob> nextJob();
+
+   /**
+   * Internal method that returns a job from the local batch, the local deque,
+   * the shared queue or a peer deque without blocking.
+   *
+   * @param jobQueue the shared queue
+   * @param localDeque this thread's deque or nullptr
+   * @return the job or nullptr
+   */
+   std::shared_ptr<multiJob> nextAvailableJob(std::shared_ptr<multiJobQueue> jobQueue,
+                                              std::shared_ptr<multi::WorkStealingDeque> localDeque);
+
+   /**
+   * Internal method called when no job is available.  Spins, yields and then
+   * blocks on the shared queue as set by the idle policy.
+   *
+   * @param jobQueue the shared queue
+   * @param localDeque this thread's deque or nullptr
+   * @return the job or nullptr if the block was released
+   */
+   std::shared_ptr<multiJob> idleWait(std::shared_ptr<multiJobQueue> jobQueue,
+                                      std::shared_ptr<multi::WorkStealingDeque> localDeque);
+
+   /**
+   * Internal method that tries each peer deque once starting after the
+   * last successful victim.
+   *
+   * @return a stolen job or nullptr
+   */
+   std::shared_ptr<multiJob> stealJob();
+
+   /**
+   * Internal method that returns the next job of the local batch skipping
+   * canceled jobs.
+   *
+   * @return the job or nullptr if the batch is empty
+   */
+   std::shared_ptr<multiJob> nextBatchedJob();
+
+   /**
+   * Internal method that fetches from the shared queue, a batch at a time if
+   * the batch size is greater than 1.
+   *
+   * @param jobQueue the shared queue
+   * @param blockIfEmptyFlag passed to the queue
+   * @return the job or nullptr
+   */
+   std::shared_ptr<multiJob> nextQueuedJob(std::shared_ptr<multiJobQueue> jobQueue,
+                                           bool blockIfEmptyFlag);
+
+   /**
+   * Internal method that moves any jobs left on the local batch and deque back
+   * to the shared job queue so they are not lost when the thread exits.
+   */
+   void flushLocalJobs();
+
+   /**
+   * Internal method that records whether the thread is taking or running
+   * jobs.  Going idle notifies the idle event.
+   *
+   * @param busyFlag true while the thread has or may be taking a job
+   */
+   void setBusy(bool busyFlag);
    
    bool                           m_doneFlag;
    mutable std::mutex             m_threadMutex;
    std::shared_ptr<multiJobQueue> m_jobQueue;
    std::shared_ptr<multiJob>      m_currentJob;
+   std::shared_ptr<multi::WorkStealingDeque> m_localDeque;
+   std::shared_ptr<const DequeList>          m_stealPeers;
+   std::size_t                               m_stealIndex;
+   std::size_t                               m_batchSize;
+   multiJob::List                            m_batch;
+   /** nodes of m_batch whose jobs were taken, given back to the job queue */
+   multiJob::List                            m_spentBatchNodes;
+   multi::IdlePolicy                         m_idlePolicy;
+   bool                                      m_returnJobOnStop;
+   std::atomic<int>                          m_numaNode;
+   std::chrono::steady_clock::time_point     m_lastJobTime;
+
+   /**
+   * Moving average of the idle time in microseconds.  Only used by the
+   * thread itself.
+   */
+   double                                    m_idleEstimate;
+
+   /**
+   * Set before the thread looks for a job and cleared only when it blocks,
+   * so a job is never between the queue and the thread unseen by
+   * hasJobsToProcess.
+   */
+   std::atomic<bool>                         m_busyFlag;
+   std::shared_ptr<multi::EventCount>        m_idleEvent;
    
 };
 
@@ -0,0 +1,202 @@
+#ifndef multiJobTimer_HEADER
+#define multiJobTimer_HEADER
+#include <Thread.h>
+#include <multiJob.h>
+#include <multiFreeList.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <list>
+#include <vector>
+#include <memory>
+
+namespace multi{
+
+   /**
+   * Hierarchical timing wheel holding jobs until a tick.  Level 0 has one
+   * slot per tick for the next 64 ticks and each higher level covers 64 times
+   * the span of the one below.  Inserting is O(1).  When the current tick
+   * reaches a level 0 slot every job in it is due, so expiry is a single
+   * splice.  Jobs on higher levels move down a level as the wheel turns past
+   * their slot.  Jobs further out than the top level wait in an overflow list
+   * that is looked at once per turn of the top level.  Entry nodes are
+   * recycled so rescheduling a job does not allocate.
+   *
+   * TimerWheel is not thread safe.  @see JobTimer
+   */
+   class OSSIM_DLL TimerWheel
+   {
+   public:
+      typedef unsigned long long Tick;
+
+      /**
+      * Holds a job until its tick and the queue it goes to
+      */
+      struct Entry
+      {
+         Tick                         m_tick;
+         std::shared_ptr<multiJob>    m_job;
+         std::weak_ptr<multiJobQueue> m_jobQueue;
+      };
+      typedef std::list<Entry, FreeListAllocator<Entry> > EntryList;
+
+      TimerWheel();
+
+      /**
+      * @return the allocator of the wheel's lists.  Lists passed to advance
+      *         must use it since entries are spliced between them.
+      */
+      EntryList::allocator_type allocator()const{return m_overflow.get_allocator();}
+
+      /**
+      * Adds an entry
+      *
+      * @param entry the entry.  Its tick must be after the current tick.
+      * @return false if the tick is not after the current tick.  The entry
+      *         is not added.
+      */
+      bool insert(const Entry& entry);
+
+      /**
+      * Turns the wheel to tick and moves the entries that are due to due
+      *
+      * @param tick the new current tick
+      * @param due receives the due entries
+      */
+      void advance(Tick tick, EntryList& due);
+
+      /**
+      * @return the next tick at which advance has work to do.  That is either
+      *         a level 0 slot that is due or the next wrap of a level below a
+      *         level holding entries.  The largest tick if the wheel is empty.
+      */
+      Tick nextEventTick()const;
+
+      /**
+      * @return the current tick
+      */
+      Tick currentTick()const{return m_current;}
+
+      /**
+      * @return the number of entries
+      */
+      std::size_t size()const{return m_size;}
+
+   private:
+      static const unsigned int SLOT_BITS = 6;
+      static const unsigned int SLOTS     = 1 << SLOT_BITS;
+      static const unsigned int LEVELS    = 4;
+
+      /**
+      * Moves the entry at iter from list to the slot for its tick
+      */
+      void place(EntryList& list, EntryList::iterator iter);
+
+      /**
+      * Moves the entries of the current slot of level down to the slots for
+      * their ticks.  Level LEVELS is the overflow list.
+      */
+      void cascade(unsigned int level);
+
+      /**
+      * @return the slot of level for tick
+      */
+      EntryList& slot(unsigned int level, Tick tick)
+      {
+         return m_slots[level*SLOTS + ((tick >> (SLOT_BITS*level)) & (SLOTS-1))];
+      }
+      const EntryList& slot(unsigned int level, Tick tick)const
+      {
+         return m_slots[level*SLOTS + ((tick >> (SLOT_BITS*level)) & (SLOTS-1))];
+      }
+
+      EntryList              m_overflow;
+      std::vector<EntryList> m_slots;
+      Tick        m_current;
+      std::size_t m_size;
+
+      /**
+      * Number of entries per level.  The last one counts the overflow list.
+      */
+      std::size_t m_levelSize[LEVELS+1];
+   };
+
+   /**
+   * JobTimer is the thread that adds scheduled jobs to their queues when
+   * they are due.  One JobTimer serves every queue so delayed jobs never hold
+   * a worker.  The thread sleeps until the next tick with work on the wheel.
+   * Ticks are 1 millisecond and a job is never added early.
+   *
+   * Normally used through multiJobQueue::addAt and multiJobQueue::addAfter.
+   */
+   class OSSIM_DLL JobTimer : public multi::Thread
+   {
+   public:
+      JobTimer();
+
+      /**
+      * Stops the thread.  Jobs still scheduled are released.
+      */
+      virtual ~JobTimer();
+
+      /**
+      * @return the timer shared by all queues.  Started on first use.
+      */
+      static std::shared_ptr<JobTimer> instance();
+
+      /**
+      * Adds job to jobQueue at the given time.  If the time has passed the
+      * job is added right away on the calling thread.  Jobs canceled while
+      * they wait are dropped.  Jobs are added ignoring the queue capacity so
+      * the timer never blocks.
+      *
+      * @param job the job
+      * @param jobQueue the queue.  Not kept alive by the timer
+      * @param when the time to add the job
+      */
+      void schedule(std::shared_ptr<multiJob> job,
+                    std::shared_ptr<multiJobQueue> jobQueue,
+                    std::chrono::steady_clock::time_point when);
+
+      /**
+      * @return the number of jobs waiting on the timer
+      */
+      std::size_t size()const;
+
+      /**
+      * Stops the thread
+      */
+      void stop();
+
+   protected:
+      virtual void run();
+
+      /**
+      * @return the tick for the time rounded up
+      */
+      TimerWheel::Tick tickOf(std::chrono::steady_clock::time_point when)const;
+
+      /**
+      * @return the tick for now rounded down.  Entries up to it are due
+      */
+      TimerWheel::Tick currentTick()const;
+
+      /**
+      * Adds the due jobs to their queues
+      */
+      void deliver(TimerWheel::EntryList& due);
+
+      mutable std::mutex                    m_timerMutex;
+      std::condition_variable               m_condition;
+      TimerWheel                            m_wheel;
+      std::chrono::steady_clock::time_point m_start;
+      bool                                  m_stopFlag;
+
+      /**
+      * Set when an entry is added so the thread recomputes its wake time
+      */
+      bool                                  m_changedFlag;
+   };
+}
+
+#endif
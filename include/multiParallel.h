@@ -0,0 +1,219 @@
+#ifndef multiParallel_HEADER
+#define multiParallel_HEADER
+#include <multiJobMultiThreadQueue.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace multi{
+
+   /**
+   * Shared state of one parallelFor or parallelReduce call.  Hands out
+   * chunks of the index range in guided style: each chunk is the remaining
+   * work divided by twice the number of participants but never less than the
+   * grain, so early chunks are large and the tail is split finely for
+   * balance.  Also tracks the helper jobs that joined so the caller can wait
+   * for exactly those.
+   */
+   class OSSIM_DLL ParallelLoop
+   {
+   public:
+      /**
+      * @param total the number of indices
+      * @param grain the smallest chunk
+      * @param participants the number of threads expected to take chunks
+      */
+      ParallelLoop(std::size_t total, std::size_t grain, std::size_t participants);
+
+      /**
+      * Claims the next chunk
+      *
+      * @param first set to the offset of the first index of the chunk
+      * @param last set to one past the offset of the last index
+      * @return false if no work is left
+      */
+      bool nextChunk(std::size_t& first, std::size_t& last);
+
+      /**
+      * Called by a helper before taking chunks.
+      *
+      * @return false if the caller has already finished and the helper must
+      *         not touch the loop body
+      */
+      bool enter();
+
+      /**
+      * Called by a helper that entered once it has no more chunks
+      */
+      void leave();
+
+      /**
+      * Called by the caller once it has no more chunks.  Stops helpers from
+      * entering and waits for the ones that did.
+      */
+      void closeAndWait();
+
+      /**
+      * Records the first exception and stops handing out chunks
+      *
+      * @param exception the exception thrown by the loop body
+      */
+      void setException(std::exception_ptr exception);
+
+      /**
+      * Rethrows the exception thrown by the loop body if any
+      */
+      void rethrowIfFailed()const;
+
+      /**
+      * @return the number of helpers worth starting for the range
+      */
+      std::size_t helpersNeeded(std::size_t available)const;
+
+   private:
+      static const std::size_t CLOSED = std::size_t(1) << (sizeof(std::size_t)*8-1);
+
+      std::size_t              m_total;
+      std::size_t              m_grain;
+      std::size_t              m_participants;
+      std::atomic<std::size_t> m_next;
+      std::atomic<std::size_t> m_active;
+      std::mutex               m_mutex;
+      std::condition_variable  m_condition;
+      std::exception_ptr       m_exception;
+   };
+
+   /**
+   * Runs the chunks of loop until none are left.  Exceptions are recorded on
+   * the loop.
+   */
+   template<class Index, class Body>
+   void runParallelChunks(ParallelLoop& loop, Index begin, Body& body)
+   {
+      try
+      {
+         std::size_t first = 0;
+         std::size_t last  = 0;
+         while(loop.nextChunk(first, last))
+         {
+            body(begin + static_cast<Index>(first), begin + static_cast<Index>(last));
+         }
+      }
+      catch(...)
+      {
+         loop.setException(std::current_exception());
+      }
+   }
+
+   /**
+   * Runs body over [begin, end) in chunks on the pool and the calling thread.
+   * Helper jobs are added to the pool's queue, one per thread at most, and
+   * the caller takes chunks too.  Helpers still queued when the caller runs
+   * out of work are canceled, so the call never waits behind unrelated jobs.
+   * An exception thrown by body is rethrown by the caller.
+   *
+   * @param pool the pool to run on.  nullptr runs everything on the caller
+   * @param begin the first index
+   * @param end one past the last index
+   * @param grain the smallest number of indices handed out at a time
+   * @param body called as body(first, last) for each chunk
+   */
+   template<class Index, class Body>
+   void parallelForRange(std::shared_ptr<multiJobMultiThreadQueue> pool,
+                         Index begin, Index end, Index grain, Body body)
+   {
+      if(!(begin < end)) return;
+      std::size_t total     = static_cast<std::size_t>(end - begin);
+      std::size_t available = pool?pool->getNumberOfThreads():0;
+      std::shared_ptr<ParallelLoop> loop =
+         std::make_shared<ParallelLoop>(total, static_cast<std::size_t>(grain), available+1);
+      std::size_t helpers = loop->helpersNeeded(available);
+
+      multiJob::List jobs;
+      if(helpers > 0)
+      {
+         Body* bodyPtr = &body;
+         for(std::size_t idx = 0; idx < helpers; ++idx)
+         {
+            // body is only touched after enter succeeds and the caller waits
+            // for every helper that entered
+            jobs.push_back(std::make_shared<multiFunctionJob>([loop, begin, bodyPtr]{
+               if(!loop->enter()) return;
+               runParallelChunks(*loop, begin, *bodyPtr);
+               loop->leave();
+            }));
+         }
+         pool->getJobQueue()->addAll(jobs, true);
+      }
+      runParallelChunks(*loop, begin, body);
+      loop->closeAndWait();
+      for(multiJob::List::iterator iter = jobs.begin(); iter != jobs.end(); ++iter)
+      {
+         if((*iter)->isReady()) (*iter)->cancel();
+      }
+      loop->rethrowIfFailed();
+   }
+
+   /**
+   * Calls fn(i) for every i in [begin, end) on the pool and the calling
+   * thread.  @see parallelForRange
+   *
+   * @code
+   * multi::parallelFor(pool, 0, height, 16, [&](int row){ filterRow(row); });
+   * @endcode
+   */
+   template<class Index, class F>
+   void parallelFor(std::shared_ptr<multiJobMultiThreadQueue> pool,
+                    Index begin, Index end, Index grain, F fn)
+   {
+      parallelForRange(pool, begin, end, grain, [&fn](Index first, Index last){
+         for(Index idx = first; idx < last; ++idx)
+         {
+            fn(idx);
+         }
+      });
+   }
+
+   /**
+   * Combines map(i) for every i in [begin, end) on the pool and the calling
+   * thread.  Each participant accumulates into its own value starting from
+   * identity and the partial values are combined at the end, so combine must
+   * be associative and commutative.
+   *
+   * @code
+   * double sum = multi::parallelReduce(pool, std::size_t(0), n, std::size_t(1024), 0.0,
+   *                                    [&](std::size_t i){ return values[i]; },
+   *                                    [](double a, double b){ return a+b; });
+   * @endcode
+   *
+   * @return the combined value or identity for an empty range
+   */
+   template<class Index, class T, class Map, class Combine>
+   T parallelReduce(std::shared_ptr<multiJobMultiThreadQueue> pool,
+                    Index begin, Index end, Index grain,
+                    T identity, Map map, Combine combine)
+   {
+      std::mutex partialMutex;
+      std::vector<T> partials;
+      parallelForRange(pool, begin, end, grain, [&](Index first, Index last){
+         T value = identity;
+         for(Index idx = first; idx < last; ++idx)
+         {
+            value = combine(value, map(idx));
+         }
+         std::lock_guard<std::mutex> lock(partialMutex);
+         partials.push_back(value);
+      });
+      T result = identity;
+      for(typename std::vector<T>::iterator iter = partials.begin(); iter != partials.end(); ++iter)
+      {
+         result = combine(result, *iter);
+      }
+      return result;
+   }
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef multiPeriodicJob_HEADER
+#define multiPeriodicJob_HEADER
+#include <multiJob.h>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+/**
+* A job that runs again and again on a queue.  Between runs it waits on the
+* shared multi::JobTimer, so many periodic tasks share the pool's threads
+* instead of each sleeping on a thread of its own.  The same job object is
+* put back on the queue for every run.
+*
+* In FIXED_RATE mode runs are due at the start time plus a whole number of
+* periods, so slow runs do not make the schedule drift.  When a run ends
+* after the next due time has passed, the MissedPolicy decides what happens
+* to the missed runs.  In FIXED_DELAY mode the next run is due one period
+* after the previous run ended.
+*
+* Canceling the job stops it.  A run that is in progress completes.
+*
+* @code
+* class PollJob : public multiPeriodicJob
+* {
+* public:
+*    PollJob():multiPeriodicJob(std::chrono::seconds(1)){}
+* protected:
+*    virtual void run(){ poll(); }
+* };
+* std::shared_ptr<PollJob> job = std::make_shared<PollJob>();
+* jobQueue->addPeriodic(job);
+* ...
+* job->cancel();
+* @endcode
+*/
+class OSSIM_DLL multiPeriodicJob : public multiJob
+{
+public:
+   typedef std::chrono::steady_clock Clock;
+
+   enum Mode
+   {
+      FIXED_RATE  = 0,
+      FIXED_DELAY = 1
+   };
+
+   /**
+   * What a FIXED_RATE job does about due times that passed while it ran
+   */
+   enum MissedPolicy
+   {
+      /**
+      * Wait for the next due time still ahead.  The passed ones are counted
+      * as missed.
+      */
+      SKIP_MISSED = 0,
+
+      /**
+      * Run once right away for all the passed due times and then continue at
+      * the next due time.  All but one are counted as missed.
+      */
+      RUN_ONCE    = 1,
+
+      /**
+      * Run once for every passed due time, back to back, until caught up
+      */
+      RUN_ALL     = 2
+   };
+
+   /**
+   * @param period the time between runs.  It is at least one clock tick.
+   * @param mode FIXED_RATE or FIXED_DELAY
+   * @param missedPolicy used in FIXED_RATE mode.  @see MissedPolicy
+   */
+   multiPeriodicJob(Clock::duration period,
+                    Mode mode = FIXED_RATE,
+                    MissedPolicy missedPolicy = SKIP_MISSED);
+
+   /**
+   * Runs the job and puts it back on its queue for the next run unless it
+   * was canceled.
+   */
+   virtual void start();
+
+   /**
+   * Stops the job.  It is not run again.
+   */
+   virtual void cancel();
+
+   /**
+   * Sets the queue the job runs on and when it first runs.  Normally called
+   * through multiJobQueue::addPeriodic.
+   *
+   * @param jobQueue the queue.  The job does not keep it alive.
+   * @param first the time of the first run.  FIXED_RATE runs are due at
+   *        this time plus whole periods.
+   */
+   void schedule(std::shared_ptr<multiJobQueue> jobQueue, Clock::time_point first);
+
+   Clock::duration period()const{return m_period;}
+   Mode mode()const{return m_mode;}
+   MissedPolicy missedPolicy()const{return m_missedPolicy;}
+
+   /**
+   * @return true once the job was canceled
+   */
+   bool isStopped()const{return m_stopFlag.load(std::memory_order_acquire);}
+
+   /**
+   * @return the number of completed runs
+   */
+   unsigned long long runCount()const{return m_runCount.load(std::memory_order_relaxed);}
+
+   /**
+   * @return the number of FIXED_RATE due times that passed without a run
+   */
+   unsigned long long missedCount()const{return m_missedCount.load(std::memory_order_relaxed);}
+
+protected:
+   /**
+   * Works out the next due time and hands the job to the timer, or to the
+   * queue if it is already due.
+   */
+   void reschedule();
+
+   Clock::duration                    m_period;
+   Mode                               m_mode;
+   MissedPolicy                       m_missedPolicy;
+   std::weak_ptr<multiJobQueue>       m_periodicQueue;
+
+   /**
+   * The due time of the pending run.  Only touched by whoever holds the job
+   * between runs.
+   */
+   Clock::time_point                  m_nextTime;
+   std::atomic<bool>                  m_stopFlag;
+   std::atomic<unsigned long long>    m_runCount;
+   std::atomic<unsigned long long>    m_missedCount;
+};
+
+/**
+* A periodic job that calls a callable on every run
+*
+* @code
+* jobQueue->addPeriodicFunction([]{ flushStats(); }, std::chrono::seconds(10));
+* @endcode
+*/
+template<class F>
+class multiPeriodicFunctionJob : public multiPeriodicJob
+{
+public:
+   multiPeriodicFunctionJob(F f,
+                            Clock::duration period,
+                            Mode mode = FIXED_RATE,
+                            MissedPolicy missedPolicy = SKIP_MISSED)
+   :multiPeriodicJob(period, mode, missedPolicy),
+    m_function(std::move(f))
+   {
+   }
+
+protected:
+   virtual void run()
+   {
+      m_function();
+   }
+
+   F m_function;
+};
+
+#endif
@@ -1,4 +1,33 @@
 #include <Thread.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+   bool setThreadAffinity(pthread_t thread, const std::vector<int>& cpus)
+   {
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      for(auto cpu:cpus)
+      {
+         if((cpu >= 0)&&(cpu < CPU_SETSIZE)) CPU_SET(cpu, &cpuSet);
+      }
+      if(cpus.empty())
+      {
+         // the kernel ignores processors that do not exist
+         for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &cpuSet);
+      }
+      if(CPU_COUNT(&cpuSet) < 1) return false;
+      return (pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet) == 0);
+   }
+#endif
+}
 
 /**
 * Barrier is a class used to block threads so we can synchronize and entry point.
@@ -184,6 +213,49 @@ void multi::Thread::yieldCurrentThread()
     std::this_thread::yield();
 }
 
+bool multi::Thread::setAffinity(const std::vector<int>& cpus)
+{
+   std::lock_guard<std::mutex> lock(m_runningMutex);
+   m_affinity = cpus;
+#if defined(__linux__)
+   if(isRunning()&&m_thread)
+   {
+      return setThreadAffinity(m_thread->native_handle(), cpus);
+   }
+   return true;
+#else
+   return false;
+#endif
+}
+
+std::vector<int> multi::Thread::affinity()const
+{
+   std::lock_guard<std::mutex> lock(m_runningMutex);
+   return m_affinity;
+}
+
+bool multi::Thread::setCurrentThreadAffinity(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+   return setThreadAffinity(pthread_self(), cpus);
+#else
+   return false;
+#endif
+}
+
+void multi::Thread::cpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+   _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+   __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+   __asm__ __volatile__("yield");
+#else
+   std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
 void multi::Thread::interrupt()
 {
    if(m_interrupt)
@@ -200,6 +272,8 @@ void multi::Thread::setInterruptable(bool flag)
 
 void multi::Thread::runInternal()
 {
+   std::vector<int> cpus = affinity();
+   if(!cpus.empty()) setCurrentThreadAffinity(cpus);
    try
    {
       if(!isInterruptable())
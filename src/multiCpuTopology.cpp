@@ -0,0 +1,106 @@
+#include <multiCpuTopology.h>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace
+{
+   /**
+   * @return the first line of the file or an empty string if it can not be read
+   */
+   std::string readLine(const std::string& path)
+   {
+      std::string result;
+      std::ifstream in(path.c_str());
+      if(in) std::getline(in, result);
+      return result;
+   }
+}
+
+multi::CpuTopology::CpuTopology()
+{
+#if defined(__linux__)
+   CpuList online = parseCpuList(readLine("/sys/devices/system/cpu/online"));
+   // node ids may have gaps so probe until a few in a row are missing
+   int missingCount = 0;
+   for(int nodeId = 0; missingCount < 8; ++nodeId)
+   {
+      std::ostringstream path;
+      path << "/sys/devices/system/node/node" << nodeId << "/cpulist";
+      std::string cpuList = readLine(path.str());
+      if(cpuList.empty())
+      {
+         ++missingCount;
+         continue;
+      }
+      missingCount = 0;
+      Node node;
+      node.id = nodeId;
+      CpuList cpus = parseCpuList(cpuList);
+      for(auto cpu:cpus)
+      {
+         if(online.empty()||(std::find(online.begin(), online.end(), cpu) != online.end()))
+         {
+            node.cpus.push_back(cpu);
+         }
+      }
+      if(!node.cpus.empty()) m_nodes.push_back(node);
+   }
+   if(m_nodes.empty()&&!online.empty())
+   {
+      Node node;
+      node.id   = 0;
+      node.cpus = online;
+      m_nodes.push_back(node);
+   }
+#endif
+   if(m_nodes.empty())
+   {
+      Node node;
+      node.id = 0;
+      unsigned int nCpus = std::thread::hardware_concurrency();
+      for(unsigned int cpu = 0; cpu < std::max(nCpus, 1u); ++cpu)
+      {
+         node.cpus.push_back(static_cast<int>(cpu));
+      }
+      m_nodes.push_back(node);
+   }
+   for(auto& node:m_nodes)
+   {
+      std::sort(node.cpus.begin(), node.cpus.end());
+      m_cpus.insert(m_cpus.end(), node.cpus.begin(), node.cpus.end());
+   }
+}
+
+int multi::CpuTopology::nodeOfCpu(int cpu)const
+{
+   for(auto& node:m_nodes)
+   {
+      if(std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end())
+      {
+         return node.id;
+      }
+   }
+   return -1;
+}
+
+multi::CpuTopology::CpuList multi::CpuTopology::parseCpuList(const std::string& cpuList)
+{
+   CpuList result;
+   std::istringstream in(cpuList);
+   std::string range;
+   while(std::getline(in, range, ','))
+   {
+      if(range.empty()) continue;
+      std::string::size_type dash = range.find('-');
+      int first = std::atoi(range.substr(0, dash).c_str());
+      int last  = (dash == std::string::npos)?first:std::atoi(range.substr(dash+1).c_str());
+      for(int cpu = first; cpu <= last; ++cpu)
+      {
+         result.push_back(cpu);
+      }
+   }
+   return result;
+}
@@ -0,0 +1,122 @@
+#include <multiForkJoin.h>
+#include <multiJobResult.h>
+
+multi::ForkJoin::ForkJoin()
+:m_threadQueue(multiJobThreadQueue::currentThreadQueue()),
+ m_group(std::make_shared<JobGroup>())
+{
+   if(m_threadQueue) m_jobQueue = m_threadQueue->getJobQueue();
+}
+
+multi::ForkJoin::ForkJoin(std::shared_ptr<multiJobQueue> jobQueue)
+:m_threadQueue(multiJobThreadQueue::currentThreadQueue()),
+ m_jobQueue(jobQueue),
+ m_group(std::make_shared<JobGroup>())
+{
+}
+
+multi::ForkJoin::~ForkJoin()
+{
+   helpUntilDone();
+}
+
+void multi::ForkJoin::fork(std::shared_ptr<multiJob> job)
+{
+   if(!job) return;
+   job->setGroup(m_group);
+   m_children.push_back(job);
+
+   // the local deque only helps if its thread takes from the same queue
+   if(m_threadQueue&&(m_threadQueue->getJobQueue() == m_jobQueue)&&
+      m_threadQueue->pushLocal(job))
+   {
+      return;
+   }
+   if(m_jobQueue)
+   {
+      // a worker must not block on a full queue while forking
+      m_jobQueue->addAll(multiJob::List(1, job), true);
+   }
+   else
+   {
+      job->start();
+   }
+}
+
+void multi::ForkJoin::join()
+{
+   helpUntilDone();
+
+   std::exception_ptr exception;
+   bool canceled = false;
+   for(std::size_t idx = 0; (idx < m_children.size())&&!exception; ++idx)
+   {
+      exception = m_children[idx]->exception();
+      canceled  = canceled||m_children[idx]->isCanceled();
+   }
+   m_children.clear();
+   if(exception) std::rethrow_exception(exception);
+   if(canceled) throw JobNotRun();
+}
+
+void multi::ForkJoin::helpUntilDone()
+{
+   // children that are still on the queue are run here, newest first since
+   // they are the deepest part of the recursion
+   if(m_jobQueue)
+   {
+      // expired children are left for the queue to drop and count
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      for(std::size_t idx = m_children.size(); idx > 0; --idx)
+      {
+         std::shared_ptr<multiJob>& child = m_children[idx-1];
+         if(m_group->count() == 0) break;
+         if(child->isReady()&&!child->isExpired(now)&&m_jobQueue->claim(child))
+         {
+            if(child->isCanceled())
+            {
+               child->finished();
+            }
+            else
+            {
+               child->start();
+            }
+         }
+      }
+   }
+   while(!isDone())
+   {
+      if(runPendingJob()) continue;
+
+      // the remaining children are running on other threads.  Wake up now and
+      // then to help with any work they spawn.
+      m_group->waitFor(1);
+   }
+}
+
+bool multi::ForkJoin::isDone()const
+{
+   if(m_group->count() == 0) return true;
+
+   // a canceled child that is not running is never started, wherever it
+   // is, so it may still hold its count
+   for(std::size_t idx = 0; idx < m_children.size(); ++idx)
+   {
+      const std::shared_ptr<multiJob>& child = m_children[idx];
+      if(child->isFinished()) continue;
+      if(!child->isCanceled()||child->isRunning()) return false;
+   }
+   return true;
+}
+
+bool multi::ForkJoin::runPendingJob()
+{
+   if(m_threadQueue) return m_threadQueue->runPendingJob();
+   if(!m_jobQueue) return false;
+
+   std::shared_ptr<multiJob> job = m_jobQueue->nextJob(false);
+   if(!job) return false;
+   if(job->isReady()) job->start();
+
+   return true;
+}
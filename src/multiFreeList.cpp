@@ -0,0 +1,119 @@
+#include <multiFreeList.h>
+#include <new>
+
+multi::FreeList::FreeList(std::size_t maxFree)
+:m_sizeClassCount(0),
+ m_maxFree(maxFree)
+{
+}
+
+multi::FreeList::~FreeList()
+{
+   for(std::size_t idx = 0; idx < m_sizeClassCount; ++idx)
+   {
+      Block* block = m_sizeClasses[idx].m_head;
+      while(block)
+      {
+         Block* next = block->m_next;
+         ::operator delete(block);
+         block = next;
+      }
+   }
+}
+
+void* multi::FreeList::allocate(std::size_t size)
+{
+   if(size < sizeof(Block)) size = sizeof(Block);
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      SizeClass* sc = sizeClass(size);
+      if(sc&&sc->m_head)
+      {
+         Block* block = sc->m_head;
+         sc->m_head = block->m_next;
+         --sc->m_count;
+         return block;
+      }
+   }
+   return ::operator new(size);
+}
+
+void multi::FreeList::deallocate(void* block, std::size_t size)
+{
+   if(!block) return;
+   if(size < sizeof(Block)) size = sizeof(Block);
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      SizeClass* sc = sizeClass(size);
+      if(sc&&(sc->m_count < m_maxFree))
+      {
+         Block* b = static_cast<Block*>(block);
+         b->m_next = sc->m_head;
+         sc->m_head = b;
+         ++sc->m_count;
+         return;
+      }
+   }
+   ::operator delete(block);
+}
+
+std::size_t multi::FreeList::freeCount()const
+{
+   std::size_t result = 0;
+   std::lock_guard<std::mutex> lock(m_mutex);
+   for(std::size_t idx = 0; idx < m_sizeClassCount; ++idx)
+   {
+      result += m_sizeClasses[idx].m_count;
+   }
+   return result;
+}
+
+void multi::FreeList::setMaxFree(std::size_t maxFree)
+{
+   Block* released = 0;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_maxFree = maxFree;
+      for(std::size_t idx = 0; idx < m_sizeClassCount; ++idx)
+      {
+         SizeClass& sc = m_sizeClasses[idx];
+         while(sc.m_count > m_maxFree)
+         {
+            Block* block = sc.m_head;
+            sc.m_head = block->m_next;
+            --sc.m_count;
+            block->m_next = released;
+            released = block;
+         }
+      }
+   }
+   while(released)
+   {
+      Block* next = released->m_next;
+      ::operator delete(released);
+      released = next;
+   }
+}
+
+std::size_t multi::FreeList::maxFree()const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_maxFree;
+}
+
+multi::FreeList::SizeClass* multi::FreeList::sizeClass(std::size_t size)
+{
+   for(std::size_t idx = 0; idx < m_sizeClassCount; ++idx)
+   {
+      if(m_sizeClasses[idx].m_size == size) return &m_sizeClasses[idx];
+   }
+   if(m_sizeClassCount < MAX_SIZE_CLASSES)
+   {
+      SizeClass& sc = m_sizeClasses[m_sizeClassCount++];
+      sc.m_size  = size;
+      sc.m_head  = 0;
+      sc.m_count = 0;
+      return &sc;
+   }
+   return 0;
+}
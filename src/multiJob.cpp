@@ -1,71 +1,253 @@
 #include <multiJob.h>
+#include <multiJobQueue.h>
+#include <Thread.h>
 
 
+multiJob::~multiJob()
+{
+   leaveGroup();
+}
+
 void multiJob::start()
 {
    setState(multiJob_RUNNING);
-   run();
+   try
+   {
+      run();
+   }
+   catch(multi::Thread::Interrupt&)
+   {
+      // the thread running the job is being canceled.  The job did not
+      // complete and the interrupt has to reach the thread to end it.
+      cancel();
+      leaveGroup();
+      throw;
+   }
+   catch(...)
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      m_exception = std::current_exception();
+   }
    if(!(state() & multiJob_CANCEL))
    {
       setState(multiJob_FINISHED);
    }
+   leaveGroup();
 }
 
-void multiJob::setState(int value, bool on)
+void multiJob::setPriority(double value)
 {
-   std::shared_ptr<multiJob> thisShared = getSharedFromThis();
+   double oldValue = 0.0;
+   std::shared_ptr<multiJobQueue> q;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      oldValue   = m_priority;
+      m_priority = value;
+      q          = m_jobQueue.lock();
+   }
+   if(q&&(oldValue != value))
+   {
+      q->priorityChanged(getSharedFromThis());
+   }
+}
 
-   // we will need to make sure that the state flags are set properly
-   // so if you turn on running then you can't have finished or ready turned onturned on
-   // but can stil have cancel turned on
-   //
-   int newState = m_state;
-   if(on)
+void multiJob::setDeadline(std::chrono::steady_clock::time_point value)
+{
+   std::shared_ptr<multiJobQueue> q;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      m_deadline = value;
+      m_hasDeadline.store(true, std::memory_order_release);
+      q = m_jobQueue.lock();
+   }
+   if(q)
    {
-      newState = ((newState | value)&multiJob_ALL);
+      q->deadlineChanged(getSharedFromThis());
+   }
+}
+
+void multiJob::clearDeadline()
+{
+   std::shared_ptr<multiJobQueue> q;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      if(!m_hasDeadline.load(std::memory_order_relaxed)) return;
+      m_hasDeadline.store(false, std::memory_order_release);
+      q = m_jobQueue.lock();
    }
-   else 
+   if(q)
    {
-      newState = ((newState & ~value)&multiJob_ALL);
+      q->deadlineChanged(getSharedFromThis());
    }
+}
 
-   int oldState     = 0;
-   int currentState = 0;
+void multiJob::setName(const multiString& value)
+{
+   bool changed = false;
    std::shared_ptr<multiJobCallback> callback;
+   std::shared_ptr<multiJobQueue> q;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      changed = value!=m_name;
+      m_name = value;
+      if(!value.empty()) m_hasKeys.store(true, std::memory_order_release);
+      callback = m_callback;
+      q = m_jobQueue.lock();
+   }
+   if(changed&&q)
+   {
+      q->nameChanged(getSharedFromThis());
+   }
+   if(changed&&callback)
+   {
+      callback->nameChanged(value, getSharedFromThis());
+   }
+}
 
-   bool stateChangedFlag = false;
+void multiJob::setId(const multiString& value)
+{
+   bool changed = false;
+   std::shared_ptr<multiJobCallback> callback;
+   std::shared_ptr<multiJobQueue> q;
    {
       std::lock_guard<std::mutex> lock(m_jobMutex);
-      
-      stateChangedFlag = newState != m_state;
-      oldState = m_state;
-      m_state = static_cast<State>(newState);
-      currentState = m_state;
+      changed = value!=m_id;
+      m_id = value;
+      if(!value.empty()) m_hasKeys.store(true, std::memory_order_release);
       callback = m_callback;
+      q = m_jobQueue.lock();
    }
-   
-   if(stateChangedFlag&&callback)
+   if(changed&&q)
    {
-      if(!(oldState&multiJob_READY)&&
-         (currentState&multiJob_READY))
-      {
-         callback->ready(thisShared);
-      }
-      else if(!(oldState&multiJob_RUNNING)&&
-              (currentState&multiJob_RUNNING))
+      q->idChanged(getSharedFromThis());
+   }
+   if(changed&&callback)
+   {
+      callback->idChanged(value, getSharedFromThis());
+   }
+}
+
+void multiJob::setState(int value, bool on)
+{
+   // we will need to make sure that the state flags are set properly
+   // so if you turn on running then you can't have finished or ready turned onturned on
+   // but can stil have cancel turned on
+   //
+   int oldState = m_state.load(std::memory_order_acquire);
+   int newState = oldState;
+   do
+   {
+      if(on)
       {
-         callback->started(thisShared);
+         newState = ((oldState | value)&multiJob_ALL);
       }
-      else if(!(oldState&multiJob_CANCEL)&&
-              (currentState&multiJob_CANCEL))
+      else 
       {
-         callback->canceled(thisShared);
+         newState = ((oldState & ~value)&multiJob_ALL);
       }
-      else if(!(oldState&multiJob_FINISHED)&&
-              (currentState&multiJob_FINISHED))
+      if(newState == oldState) return;
+   } while(!m_state.compare_exchange_weak(oldState, newState,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire));
+
+   notifyStateChanged(oldState, newState);
+}
+
+void multiJob::resetState(int value)
+{
+   int oldState = m_state.load(std::memory_order_acquire);
+   do
+   {
+      if(value == oldState) return;
+   } while(!m_state.compare_exchange_weak(oldState, value,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire));
+
+   // a reset is reported as a transition from no state
+   notifyStateChanged(multiJob_NONE, value);
+}
+
+void multiJob::finished()
+{
+   int oldState = m_state.load(std::memory_order_acquire);
+   int newState = oldState;
+   do
+   {
+      // maintain the cancel flag so we can indicate the job has now finished
+      newState = ((oldState & multiJob_CANCEL) | multiJob_FINISHED);
+      if(newState == oldState)
       {
-         callback->finished(thisShared);
+         leaveGroup();
+         return;
       }
+   } while(!m_state.compare_exchange_weak(oldState, newState,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire));
+
+   notifyStateChanged(multiJob_NONE, newState);
+   leaveGroup();
+}
+
+void multiJob::setGroup(std::shared_ptr<multi::JobGroup> group)
+{
+   // a finished job would never leave the group again
+   if(isFinished()) return;
+   if(group) group->add();
+   std::shared_ptr<multi::JobGroup> oldGroup;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      oldGroup = m_group;
+      m_group  = group;
+      m_hasGroup.store(group != nullptr, std::memory_order_release);
    }
+   if(oldGroup) oldGroup->done();
+
+   // the job may have finished while the group was set
+   if(isFinished()) leaveGroup();
+}
+
+void multiJob::leaveGroup()
+{
+   if(!m_hasGroup.load(std::memory_order_acquire)) return;
+   std::shared_ptr<multi::JobGroup> group;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      group.swap(m_group);
+      m_hasGroup.store(false, std::memory_order_release);
+   }
+   if(group) group->done();
 }
 
+void multiJob::notifyStateChanged(int oldState, int newState)
+{
+   if(!m_hasCallback.load(std::memory_order_acquire)) return;
+
+   std::shared_ptr<multiJobCallback> callback;
+   {
+      std::lock_guard<std::mutex> lock(m_jobMutex);
+      callback = m_callback;
+   }
+   if(!callback) return;
+
+   std::shared_ptr<multiJob> thisShared = getSharedFromThis();
+   if(!(oldState&multiJob_READY)&&
+      (newState&multiJob_READY))
+   {
+      callback->ready(thisShared);
+   }
+   else if(!(oldState&multiJob_RUNNING)&&
+           (newState&multiJob_RUNNING))
+   {
+      callback->started(thisShared);
+   }
+   else if(!(oldState&multiJob_CANCEL)&&
+           (newState&multiJob_CANCEL))
+   {
+      callback->canceled(thisShared);
+   }
+   else if(!(oldState&multiJob_FINISHED)&&
+           (newState&multiJob_FINISHED))
+   {
+      callback->finished(thisShared);
+   }
+}
@@ -0,0 +1,230 @@
+#include <multiJobGraph.h>
+#include <chrono>
+
+/**
+* The job added to the queue for a node.  It runs the node's job and then
+* releases the successors whose last predecessor this was.
+*/
+class multiJobGraph::NodeJob : public multiJob
+{
+public:
+   NodeJob(std::shared_ptr<multiJobGraph> graph, std::shared_ptr<multiJob> job)
+   :m_graph(graph),
+    m_job(job),
+    m_pending(0)
+   {}
+
+   virtual void cancel()
+   {
+      multiJob::cancel();
+      m_job->cancel();
+   }
+
+   std::weak_ptr<multiJobGraph>   m_graph;
+   std::shared_ptr<multiJob>      m_job;
+   std::vector<Node>              m_successors;
+
+   /**
+   * Number of predecessors that have not finished
+   */
+   std::atomic<std::size_t>       m_pending;
+
+protected:
+   virtual void run()
+   {
+      std::shared_ptr<multiJobGraph> graph = m_graph.lock();
+      if(!graph||!graph->nodeStarting()) return;
+      m_job->start();
+      graph->nodeFinished(this, (m_job->exception()||m_job->isCanceled()));
+   }
+};
+
+multiJobGraph::multiJobGraph()
+:m_remaining(0),
+ m_runningCount(0),
+ m_startedFlag(false),
+ m_canceledFlag(false)
+{
+}
+
+multiJobGraph::~multiJobGraph()
+{
+}
+
+multiJobGraph::Node multiJobGraph::add(std::shared_ptr<multiJob> job)
+{
+   if(!job) return INVALID_NODE;
+   std::shared_ptr<NodeJob> node = std::make_shared<NodeJob>(shared_from_this(), job);
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   // running nodes read m_nodes without the lock
+   if(m_startedFlag) return INVALID_NODE;
+   m_nodes.push_back(node);
+   return m_nodes.size()-1;
+}
+
+bool multiJobGraph::addEdge(Node from, Node to)
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   if(m_startedFlag||(from >= m_nodes.size())||(to >= m_nodes.size())) return false;
+   m_nodes[from]->m_successors.push_back(to);
+   ++m_nodes[to]->m_pending;
+   return true;
+}
+
+bool multiJobGraph::run(std::shared_ptr<multiJobQueue> jobQueue)
+{
+   multiJob::List roots;
+   {
+      std::lock_guard<std::mutex> lock(m_graphMutex);
+      if(m_startedFlag||!jobQueue) return false;
+
+      // a cycle would leave its nodes waiting forever so check that every
+      // node can be reached in dependency order
+      std::vector<std::size_t> pending(m_nodes.size());
+      std::vector<Node> ready;
+      for(Node idx = 0; idx < m_nodes.size(); ++idx)
+      {
+         pending[idx] = m_nodes[idx]->m_pending;
+         if(pending[idx] == 0) ready.push_back(idx);
+      }
+      std::size_t visited = 0;
+      while(!ready.empty())
+      {
+         Node node = ready.back();
+         ready.pop_back();
+         ++visited;
+         for(Node successor:m_nodes[node]->m_successors)
+         {
+            if(--pending[successor] == 0) ready.push_back(successor);
+         }
+      }
+      if(visited != m_nodes.size()) return false;
+
+      m_startedFlag = true;
+      m_jobQueue    = jobQueue;
+      m_remaining   = m_nodes.size();
+      for(std::size_t idx = 0; idx < m_nodes.size(); ++idx)
+      {
+         if(m_nodes[idx]->m_pending == 0) roots.push_back(m_nodes[idx]);
+      }
+      if(m_nodes.empty()) m_doneCondition.notify_all();
+   }
+   jobQueue->addAll(roots);
+
+   return true;
+}
+
+void multiJobGraph::wait()
+{
+   std::unique_lock<std::mutex> lock(m_graphMutex);
+   m_doneCondition.wait(lock, [this]{return isDoneNoLock();});
+}
+
+bool multiJobGraph::waitFor(unsigned long long waitTimeMillis)
+{
+   std::unique_lock<std::mutex> lock(m_graphMutex);
+   return m_doneCondition.wait_for(lock,
+                                   std::chrono::milliseconds(waitTimeMillis),
+                                   [this]{return isDoneNoLock();});
+}
+
+void multiJobGraph::cancel()
+{
+   std::vector<std::shared_ptr<NodeJob> > nodes;
+   {
+      std::lock_guard<std::mutex> lock(m_graphMutex);
+      if(m_canceledFlag) return;
+      m_canceledFlag = true;
+      nodes = m_nodes;
+      if(isDoneNoLock()) m_doneCondition.notify_all();
+   }
+
+   // queued nodes are purged by the queue.  A node that is dequeued anyway
+   // does not start its job since the graph is canceled.
+   for(std::shared_ptr<NodeJob>& node:nodes)
+   {
+      if(!node->isFinished()) node->cancel();
+   }
+}
+
+bool multiJobGraph::isCanceled()const
+{
+   return m_canceledFlag;
+}
+
+bool multiJobGraph::isDone()const
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   return isDoneNoLock();
+}
+
+std::exception_ptr multiJobGraph::exception()const
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   return m_exception;
+}
+
+std::size_t multiJobGraph::size()const
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   return m_nodes.size();
+}
+
+std::shared_ptr<multiJob> multiJobGraph::job(Node node)const
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   if(node >= m_nodes.size()) return std::shared_ptr<multiJob>();
+   return m_nodes[node]->m_job;
+}
+
+void multiJobGraph::nodeFinished(NodeJob* node, bool failedFlag)
+{
+   if(failedFlag)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_graphMutex);
+         if(!m_exception) m_exception = node->m_job->exception();
+      }
+      cancel();
+   }
+
+   // only the worker that takes the count to zero releases the successor.
+   // m_nodes does not change once the graph is running.
+   multiJob::List released;
+   if(!m_canceledFlag)
+   {
+      for(Node idx:node->m_successors)
+      {
+         const std::shared_ptr<NodeJob>& successor = m_nodes[idx];
+         if(successor->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+         {
+            released.push_back(successor);
+         }
+      }
+   }
+   if(!released.empty())
+   {
+      // a worker must not block on a full queue while releasing work
+      m_jobQueue->addAll(released, true);
+   }
+
+   --m_remaining;
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   --m_runningCount;
+   if(isDoneNoLock()) m_doneCondition.notify_all();
+}
+
+bool multiJobGraph::nodeStarting()
+{
+   std::lock_guard<std::mutex> lock(m_graphMutex);
+   if(m_canceledFlag) return false;
+   ++m_runningCount;
+   return true;
+}
+
+bool multiJobGraph::isDoneNoLock()const
+{
+   if(!m_startedFlag) return true;
+   if(m_remaining == 0) return true;
+   return (m_canceledFlag&&(m_runningCount == 0));
+}
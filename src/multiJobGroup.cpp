@@ -0,0 +1,39 @@
+#include <multiJobGroup.h>
+#include <chrono>
+
+multi::JobGroup::JobGroup()
+:m_count(0)
+{
+}
+
+void multi::JobGroup::add(std::size_t count)
+{
+   m_count.fetch_add(count, std::memory_order_acq_rel);
+}
+
+void multi::JobGroup::done()
+{
+   if(m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+   {
+      // taking the lock keeps a waiter from missing the wakeup between its
+      // check and its wait
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_condition.notify_all();
+   }
+}
+
+void multi::JobGroup::wait()
+{
+   if(count() == 0) return;
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_condition.wait(lock, [this]{return count() == 0;});
+}
+
+bool multi::JobGroup::waitFor(unsigned long long waitTimeMillis)
+{
+   if(count() == 0) return true;
+   std::unique_lock<std::mutex> lock(m_mutex);
+   return m_condition.wait_for(lock,
+                               std::chrono::milliseconds(waitTimeMillis),
+                               [this]{return count() == 0;});
+}
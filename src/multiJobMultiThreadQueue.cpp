@@ -1,14 +1,70 @@
 #include <multiJobMultiThreadQueue.h>
+#include <algorithm>
+
+/**
+* Monitor thread used by the pool while auto scaling.  It calls
+* adjustThreads every check interval until stopped.
+*/
+class multiJobMultiThreadQueue::ScalingThread : public multi::Thread
+{
+public:
+   ScalingThread(multiJobMultiThreadQueue* pool, unsigned long long checkIntervalMillis)
+   :m_pool(pool),
+    m_checkIntervalMillis(checkIntervalMillis),
+    m_stopFlag(false)
+   {
+   }
+   virtual ~ScalingThread()
+   {
+      stop();
+      waitForCompletion();
+   }
+   void stop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stopFlag = true;
+      }
+      m_condition.notify_all();
+   }
+
+protected:
+   virtual void run()
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(!m_stopFlag)
+      {
+         m_condition.wait_for(lock, 
+                              std::chrono::milliseconds(m_checkIntervalMillis),
+                              [this]{return m_stopFlag;});
+         if(m_stopFlag) break;
+         lock.unlock();
+         m_pool->adjustThreads();
+         lock.lock();
+      }
+   }
+
+   multiJobMultiThreadQueue* m_pool;
+   unsigned long long        m_checkIntervalMillis;
+   bool                      m_stopFlag;
+   std::mutex                m_mutex;
+   std::condition_variable   m_condition;
+};
 
 multiJobMultiThreadQueue::multiJobMultiThreadQueue(std::shared_ptr<multiJobQueue> q, 
                                                    unsigned int nThreads)
-:m_jobQueue(q?q:std::make_shared<multiJobQueue>())
+:m_jobQueue(q?q:std::make_shared<multiJobQueue>()),
+ m_workStealing(false),
+ m_batchSize(1),
+ m_placementMode(NO_PLACEMENT),
+ m_idleEvent(std::make_shared<multi::EventCount>())
 {
    setNumberOfThreads(nThreads);
 }
 
 multiJobMultiThreadQueue::~multiJobMultiThreadQueue()
 {
+   disableAutoScaling();
    cancel();
    waitForCompletion();
    m_threadQueueList.clear();
@@ -36,29 +92,24 @@ void multiJobMultiThreadQueue::setJobQueue(std::shared_ptr<multiJobQueue> q)
 }
 void multiJobMultiThreadQueue::setNumberOfThreads(unsigned int nThreads)
 {
-   std::lock_guard<std::mutex> lock(m_mutex);
-   size_t idx = 0;
-   size_t queueSize = m_threadQueueList.size();
-
-   
-   if(nThreads > queueSize)
+   ThreadQueueList removed;
    {
-      for(idx = queueSize; idx < nThreads;++idx)
+      std::lock_guard<std::mutex> lock(m_mutex);
+      size_t queueSize = m_threadQueueList.size();
+
+      if(nThreads > queueSize)
       {
-         std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>();
-         threadQueue->setJobQueue(m_jobQueue);
-         m_threadQueueList.push_back(threadQueue);
+         addThreads(nThreads - queueSize);
       }
-   }
-   else if(nThreads < queueSize)
-   {
-      ThreadQueueList::iterator iter = m_threadQueueList.begin()+nThreads;
-      while(iter != m_threadQueueList.end())
+      else if(nThreads < queueSize)
       {
-         (*iter)->cancel();
-         iter = m_threadQueueList.erase(iter);
+         removed.assign(m_threadQueueList.begin()+nThreads, m_threadQueueList.end());
+         m_threadQueueList.erase(m_threadQueueList.begin()+nThreads, m_threadQueueList.end());
       }
+      applyPlacement();
+      updateStealPeers();
    }
+   stopThreads(removed, true);
 }
 
 unsigned int multiJobMultiThreadQueue::getNumberOfThreads() const
@@ -109,12 +160,342 @@ bool multiJobMultiThreadQueue::hasJobsToProcess()const
    return result;
 }
 
-void multiJobMultiThreadQueue::cancel()
+void multiJobMultiThreadQueue::waitForIdle()const
+{
+   for(;;)
+   {
+      // register before checking so a thread going idle after the check
+      // still wakes us
+      multi::EventCount::Key key = m_idleEvent->prepareWait();
+      if(!hasJobsToProcess())
+      {
+         m_idleEvent->cancelWait();
+         return;
+      }
+      m_idleEvent->wait(key);
+   }
+}
+
+bool multiJobMultiThreadQueue::waitForIdle(unsigned long long waitTimeMillis)const
 {
+   std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                                                    std::chrono::milliseconds(waitTimeMillis);
+   for(;;)
+   {
+      multi::EventCount::Key key = m_idleEvent->prepareWait();
+      if(!hasJobsToProcess())
+      {
+         m_idleEvent->cancelWait();
+         return true;
+      }
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(now >= deadline)
+      {
+         m_idleEvent->cancelWait();
+         return false;
+      }
+      m_idleEvent->wait(key, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()+1);
+   }
+}
+
+void multiJobMultiThreadQueue::setBatchSize(std::size_t batchSize)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   m_batchSize = (batchSize > 0)?batchSize:1;
+   for(auto thread:m_threadQueueList)
+   {
+      thread->setBatchSize(m_batchSize);
+   }
+}
+
+std::size_t multiJobMultiThreadQueue::batchSize()const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_batchSize;
+}
+
+void multiJobMultiThreadQueue::setIdlePolicy(const multi::IdlePolicy& policy)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   m_idlePolicy = policy;
    for(auto thread:m_threadQueueList)
    {
-      thread->cancel();
+      thread->setIdlePolicy(m_idlePolicy);
+   }
+}
+
+multi::IdlePolicy multiJobMultiThreadQueue::idlePolicy()const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_idlePolicy;
+}
+
+void multiJobMultiThreadQueue::setAutoScaling(const multi::ScalingPolicy& policy)
+{
+   std::shared_ptr<ScalingThread> oldThread;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_scalingPolicy = policy;
+      oldThread = m_scalingThread;
+      m_scalingThread = std::make_shared<ScalingThread>(this, policy.checkIntervalMillis());
+      m_scalingThread->start();
+   }
+   // the old monitor may be inside adjustThreads so it is stopped without
+   // holding the lock
+   oldThread.reset();
+   adjustThreads();
+}
+
+void multiJobMultiThreadQueue::disableAutoScaling()
+{
+   std::shared_ptr<ScalingThread> oldThread;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      oldThread.swap(m_scalingThread);
+   }
+   oldThread.reset();
+}
+
+bool multiJobMultiThreadQueue::isAutoScaling()const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return (m_scalingThread != nullptr);
+}
+
+void multiJobMultiThreadQueue::addThreads(std::size_t count)
+{
+   for(std::size_t idx = 0; idx < count;++idx)
+   {
+      std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>();
+      threadQueue->setBatchSize(m_batchSize);
+      threadQueue->setIdlePolicy(m_idlePolicy);
+      threadQueue->setIdleEvent(m_idleEvent);
+      m_threadQueueList.push_back(threadQueue);
+   }
+   // place the new threads before setJobQueue starts them
+   applyPlacement();
+   for(std::size_t idx = m_threadQueueList.size()-count; idx < m_threadQueueList.size();++idx)
+   {
+      m_threadQueueList[idx]->setJobQueue(m_jobQueue);
+   }
+}
+
+void multiJobMultiThreadQueue::setPlacement(PlacementMode mode, const std::vector<int>& cpus)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   m_placementMode = mode;
+   m_placementCpus = cpus;
+   if((mode != NO_PLACEMENT)&&!m_topology)
+   {
+      m_topology = std::make_shared<multi::CpuTopology>();
+   }
+   applyPlacement();
+}
+
+multiJobMultiThreadQueue::PlacementMode multiJobMultiThreadQueue::placementMode()const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_placementMode;
+}
+
+void multiJobMultiThreadQueue::applyPlacement()
+{
+   std::size_t nThreads = m_threadQueueList.size();
+   if((m_placementMode == NO_PLACEMENT)||!m_topology)
+   {
+      for(auto thread:m_threadQueueList)
+      {
+         if(!thread->affinity().empty()) thread->setAffinity(std::vector<int>());
+         thread->setNumaNode(-1);
+      }
+      return;
+   }
+
+   const multi::CpuTopology& topology = *m_topology;
+   std::size_t nNodes = topology.numberOfNodes();
+   for(std::size_t idx = 0; idx < nThreads; ++idx)
+   {
+      std::vector<int> cpus;
+      int node = -1;
+      switch(m_placementMode)
+      {
+         case COMPACT_PLACEMENT:
+         {
+            cpus.push_back(topology.cpus()[idx%topology.cpus().size()]);
+            node = topology.nodeOfCpu(cpus.front());
+            break;
+         }
+         case SCATTER_PLACEMENT:
+         {
+            const multi::CpuTopology::Node& n = topology.node(idx%nNodes);
+            cpus.push_back(n.cpus[(idx/nNodes)%n.cpus.size()]);
+            node = n.id;
+            break;
+         }
+         case EXPLICIT_PLACEMENT:
+         {
+            if(!m_placementCpus.empty())
+            {
+               cpus.push_back(m_placementCpus[idx%m_placementCpus.size()]);
+               node = topology.nodeOfCpu(cpus.front());
+            }
+            break;
+         }
+         default:
+            break;
+      }
+      m_threadQueueList[idx]->setAffinity(cpus);
+      m_threadQueueList[idx]->setNumaNode(node);
+   }
+}
+
+void multiJobMultiThreadQueue::adjustThreads()
+{
+   ThreadQueueList retired;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_scalingThread) return;
+
+      const multi::ScalingPolicy& policy = m_scalingPolicy;
+      std::size_t nThreads = m_threadQueueList.size();
+      std::size_t depth = m_jobQueue?m_jobQueue->size():0;
+      bool backedUp = false;
+      if(depth > 0)
+      {
+         if(policy.queueDepthThreshold() > 0)
+         {
+            backedUp = (depth > policy.queueDepthThreshold());
+         }
+         if(!backedUp&&(policy.waitThresholdMillis() > 0))
+         {
+            backedUp = (m_jobQueue->oldestJobWaitMillis() > policy.waitThresholdMillis());
+         }
+      }
+
+      std::size_t target = nThreads;
+      if(backedUp)
+      {
+         std::size_t idleCount = 0;
+         for(auto thread:m_threadQueueList)
+         {
+            if(!thread->isProcessingJob()) ++idleCount;
+         }
+         // idle threads will pick up queued jobs on their own.  Grow by at
+         // most the current size per check so a short burst does not jump
+         // straight to the maximum
+         if(depth > idleCount)
+         {
+            target = nThreads + std::min(depth - idleCount, std::max<std::size_t>(nThreads, 1));
+         }
+      }
+      else
+      {
+         ThreadQueueList::iterator iter = m_threadQueueList.begin();
+         while((iter != m_threadQueueList.end())&&
+               (m_threadQueueList.size() > policy.minThreads()))
+         {
+            if((*iter)->idleMillis() >= policy.keepAliveMillis())
+            {
+               retired.push_back(*iter);
+               iter = m_threadQueueList.erase(iter);
+            }
+            else
+            {
+               ++iter;
+            }
+         }
+         nThreads = target = m_threadQueueList.size();
+      }
+      target = std::max<std::size_t>(std::min<std::size_t>(target, policy.maxThreads()), 
+                                     policy.minThreads());
+      if(target > nThreads)
+      {
+         addThreads(target - nThreads);
+      }
+      else if(target < nThreads)
+      {
+         retired.insert(retired.end(), m_threadQueueList.begin()+target, m_threadQueueList.end());
+         m_threadQueueList.erase(m_threadQueueList.begin()+target, m_threadQueueList.end());
+      }
+      if(target != nThreads || !retired.empty())
+      {
+         applyPlacement();
+         updateStealPeers();
+      }
+   }
+   stopThreads(retired, false);
+}
+
+void multiJobMultiThreadQueue::stopThreads(const ThreadQueueList& threads, bool cancelCurrentJobFlag)
+{
+   // ask all of them first so they wind down together
+   for(auto thread:threads)
+   {
+      if(thread->isRunning()) thread->stop(cancelCurrentJobFlag);
+   }
+   for(auto thread:threads)
+   {
+      thread->waitForStop();
+   }
+}
+
+void multiJobMultiThreadQueue::setWorkStealing(bool flag)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   m_workStealing = flag;
+   updateStealPeers();
+}
+
+bool multiJobMultiThreadQueue::isWorkStealing()const
+{
+   return m_workStealing.load(std::memory_order_relaxed);
+}
+
+void multiJobMultiThreadQueue::add(std::shared_ptr<multiJob> job)
+{
+   std::shared_ptr<multiJobQueue> jobQueue = getJobQueue();
+   if(m_workStealing.load(std::memory_order_relaxed))
+   {
+      // only route to the deque of a thread that belongs to this pool
+      multiJobThreadQueue* threadQueue = multiJobThreadQueue::currentThreadQueue();
+      if(threadQueue&&(threadQueue->getJobQueue() == jobQueue)&&
+         threadQueue->pushLocal(job))
+      {
+         // wake one parked thread so it can steal it
+         jobQueue->wakeConsumer();
+         return;
+      }
+   }
+   jobQueue->add(job);
+}
+
+void multiJobMultiThreadQueue::updateStealPeers()
+{
+   if(!m_workStealing.load(std::memory_order_relaxed)) return;
+
+   std::shared_ptr<multiJobThreadQueue::DequeList> peers = 
+      std::make_shared<multiJobThreadQueue::DequeList>();
+   for(auto thread:m_threadQueueList)
+   {
+      std::shared_ptr<multi::WorkStealingDeque> deque = thread->localDeque();
+      if(!deque) deque = std::make_shared<multi::WorkStealingDeque>();
+      peers->push_back(deque);
+   }
+   // once a thread owns a deque it keeps it so no pushed job is dropped
+   for(std::size_t idx = 0; idx < m_threadQueueList.size(); ++idx)
+   {
+      m_threadQueueList[idx]->setWorkStealing((*peers)[idx], peers);
+   }
+}
+
+void multiJobMultiThreadQueue::cancel()
+{
+   ThreadQueueList threads;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      threads = m_threadQueueList;
    }
+   stopThreads(threads, true);
 }
 
 void multiJobMultiThreadQueue::waitForCompletion()
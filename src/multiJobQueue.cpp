@@ -1,6 +1,9 @@
 #include <multiJobQueue.h>
-#include <algorithm> /* for std::find */
+#include <multiJobTimer.h>
 #include <iostream>
+#include <limits>
+#include <algorithm>
+#include <unordered_set>
 
 
 /**
@@ -38,6 +41,28 @@ void multi::Block::set(bool releaseFlag)
    m_conditionVariable.notify_all();
 }
 
+void multi::Block::set(bool releaseFlag, std::size_t wakeCount)
+{
+   bool wakeAll = false;
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      m_release = releaseFlag;
+      wakeAll = (wakeCount >= static_cast<std::size_t>(m_waitCount.load()));
+   }
+   if(wakeAll)
+   {
+      m_conditionVariable.notify_all();
+   }
+   else
+   {
+      for(std::size_t idx = 0; idx < wakeCount; ++idx)
+      {
+         m_conditionVariable.notify_one();
+      }
+   }
+}
+
 void multi::Block::block()
 {
    std::unique_lock<std::mutex> lock(m_mutex);
@@ -50,7 +75,7 @@ void multi::Block::block()
       --m_waitCount;
       if(m_waitCount < 0) m_waitCount = 0;
    }
-   m_conditionVariable.notify_all();   
+   // waiters are woken by set and release, only the destructor waits on exit
    m_conditionalWait.notify_all();
 }
 
@@ -68,7 +93,7 @@ void multi::Block::block(unsigned long long waitTimeMillis)
       --m_waitCount;
       if(m_waitCount < 0) m_waitCount = 0;
    }
-   m_conditionVariable.notify_all();   
+   // waiters are woken by set and release, only the destructor waits on exit
    m_conditionalWait.notify_all();
 }
 void multi::Block::release()
@@ -91,6 +116,84 @@ void multi::Block::reset()
    m_waitCount = 0;
 }
 
+multi::EventCount::EventCount()
+:m_epoch(0), m_waitCount(0)
+{
+}
+
+multi::EventCount::Key multi::EventCount::prepareWait()
+{
+   // the count is published before the epoch is read so a notifier that
+   // misses this waiter happened before the caller checks its condition
+   m_waitCount.fetch_add(1);
+   return m_epoch.load();
+}
+
+void multi::EventCount::cancelWait()
+{
+   m_waitCount.fetch_sub(1);
+}
+
+void multi::EventCount::wait(Key key)
+{
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_conditionVariable.wait(lock, [this, key]{return m_epoch.load() != key;});
+   }
+   m_waitCount.fetch_sub(1);
+}
+
+bool multi::EventCount::wait(Key key, unsigned long long waitTimeMillis)
+{
+   bool result = false;
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      result = m_conditionVariable.wait_for(lock,
+                                            std::chrono::milliseconds(waitTimeMillis),
+                                            [this, key]{return m_epoch.load() != key;});
+   }
+   m_waitCount.fetch_sub(1);
+   return result;
+}
+
+void multi::EventCount::notify(std::size_t count)
+{
+   if(count < 1) return;
+   // pairs with the increment in prepareWait
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   int waitCount = m_waitCount.load(std::memory_order_relaxed);
+   if(waitCount < 1) return;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ++m_epoch;
+   }
+   if(count >= static_cast<std::size_t>(waitCount))
+   {
+      m_conditionVariable.notify_all();
+   }
+   else
+   {
+      for(std::size_t idx = 0; idx < count; ++idx)
+      {
+         m_conditionVariable.notify_one();
+      }
+   }
+}
+
+void multi::EventCount::notifyAll()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ++m_epoch;
+   }
+   m_conditionVariable.notify_all();
+}
+
+int multi::EventCount::waitCount()const
+{
+   return m_waitCount.load();
+}
+
 
 
 /**
@@ -102,40 +205,244 @@ void multi::Block::reset()
 * The job queue is thread safe and can be shared by multiple threads.
 **/
 
-multiJobQueue::multiJobQueue()
+multiJobQueue::multiJobQueue(OrderingMode mode)
+:m_releaseFlag(false),
+ m_orderingMode(mode),
+ m_freeList(std::make_shared<multi::FreeList>()),
+ m_bands(BandMap::key_compare(), BandMap::allocator_type(m_freeList)),
+ m_jobIndex(0, JobIndex::hasher(), JobIndex::key_equal(), JobIndex::allocator_type(m_freeList)),
+ m_idIndex(0, KeyIndex::hasher(), KeyIndex::key_equal(), KeyIndex::allocator_type(m_freeList)),
+ m_nameIndex(0, KeyIndex::hasher(), KeyIndex::key_equal(), KeyIndex::allocator_type(m_freeList)),
+ m_arrivals(ArrivalList::allocator_type(m_freeList)),
+ m_capacity(0),
+ m_reservedCount(0),
+ m_spaceWaitCount(0),
+ m_spaceReleaseCount(0),
+ m_deadlineMissCount(0),
+ m_jobCount(0),
+ m_sequence(0),
+ m_fairTenant(0),
+ m_fairCredit(0),
+ m_priorityAging(0.0),
+ m_waitStatsBands(1, 0.0)
+{
+   TenantStats defaultTenant;
+   defaultTenant.weight     = 1;
+   defaultTenant.depth      = 0;
+   defaultTenant.dispatched = 0;
+   m_tenants.push_back(defaultTenant);
+   m_tenantIndex.insert(std::make_pair(multiString(), std::size_t(0)));
+}
+
+multiJobQueue::~multiJobQueue()
 {
 }
 
-void multiJobQueue::add(std::shared_ptr<multiJob> job, 
+void multiJobQueue::setOrderingMode(OrderingMode mode)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   if(m_orderingMode == mode) return;
+   m_orderingMode = mode;
+   m_fairCredit   = 0;
+
+   // re-band in queue order so FIFO gets the arrival order back
+   rebandAll();
+}
+
+multiJobQueue::OrderingMode multiJobQueue::orderingMode()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_orderingMode;
+}
+
+void multiJobQueue::setPriorityAging(double priorityPerSecond)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   priorityPerSecond = std::max(priorityPerSecond, 0.0);
+   if(m_priorityAging == priorityPerSecond) return;
+   m_priorityAging = priorityPerSecond;
+   if(m_orderingMode == PRIORITY_ORDERING) rebandAll();
+}
+
+double multiJobQueue::priorityAging()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_priorityAging;
+}
+
+std::map<double, unsigned long long> multiJobQueue::maxWaitMillisByPriority()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_maxWaitMillis;
+}
+
+void multiJobQueue::setWaitStatsBands(const std::vector<double>& lowerBounds)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   m_waitStatsBands = lowerBounds;
+   if(m_waitStatsBands.empty()) m_waitStatsBands.push_back(0.0);
+   std::sort(m_waitStatsBands.begin(), m_waitStatsBands.end());
+   m_waitStatsBands.erase(std::unique(m_waitStatsBands.begin(), m_waitStatsBands.end()),
+                          m_waitStatsBands.end());
+   m_maxWaitMillis.clear();
+}
+
+std::vector<double> multiJobQueue::waitStatsBands()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_waitStatsBands;
+}
+
+void multiJobQueue::resetMaxWait()
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   m_maxWaitMillis.clear();
+}
+
+void multiJobQueue::setTenantWeight(const multiString& tenant, unsigned int weight)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   m_tenants[tenantIndex(tenant)].weight = std::max(weight, 1u);
+}
+
+multiJobQueue::TenantStats multiJobQueue::tenantStats(const multiString& tenant)const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   std::unordered_map<multiString, std::size_t>::const_iterator iter = m_tenantIndex.find(tenant);
+   if(iter != m_tenantIndex.end()) return m_tenants[iter->second];
+
+   TenantStats result;
+   result.tenant     = tenant;
+   result.weight     = 1;
+   result.depth      = 0;
+   result.dispatched = 0;
+   return result;
+}
+
+std::vector<multiJobQueue::TenantStats> multiJobQueue::allTenantStats()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_tenants;
+}
+
+void multiJobQueue::setCapacity(std::size_t capacity)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   m_capacity = capacity;
+   // the new capacity may have room for everyone so let them re-check
+   if(m_spaceWaitCount > 0) m_spaceCondition.notify_all();
+}
+
+std::size_t multiJobQueue::capacity()const
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   return m_capacity;
+}
+
+bool multiJobQueue::add(std::shared_ptr<multiJob> job, 
                         bool guaranteeUniqueFlag)
 {
+   return addJob(job, guaranteeUniqueFlag, true, 0);
+}
+
+bool multiJobQueue::tryAdd(std::shared_ptr<multiJob> job)
+{
+   return addJob(job, true, false, 0);
+}
+
+bool multiJobQueue::addFor(std::shared_ptr<multiJob> job, unsigned long long waitTimeMillis)
+{
+   std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+
+                                                    std::chrono::milliseconds(waitTimeMillis);
+   return addJob(job, true, true, &deadline);
+}
+
+void multiJobQueue::addAt(std::shared_ptr<multiJob> job, std::chrono::steady_clock::time_point when)
+{
+   if(!job) return;
+   multi::JobTimer::instance()->schedule(job, getSharedFromThis(), when);
+}
+
+void multiJobQueue::addPeriodic(std::shared_ptr<multiPeriodicJob> job,
+                                multiPeriodicJob::Clock::duration initialDelay)
+{
+   if(!job) return;
+   job->schedule(getSharedFromThis(), multiPeriodicJob::Clock::now() + initialDelay);
+}
+
+std::size_t multiJobQueue::addAll(const multiJob::List& jobs, bool ignoreCapacity)
+{
+   std::size_t result = 0;
+   multiJob::List newJobs;
    std::shared_ptr<Callback> cb;
    {
+      std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+      std::unordered_set<const multiJob*> batch;
+      for(multiJob::List::const_iterator iter = jobs.begin();iter != jobs.end();++iter)
       {
-         std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-         
-         if(guaranteeUniqueFlag)
+         // also drops duplicates within the batch
+         if(*iter&&(m_jobIndex.find(iter->get()) == m_jobIndex.end())&&
+            batch.insert(iter->get()).second)
          {
-            if(findByPointer(job) != m_jobQueue.end())
-            {
-               m_block.set(true);
-               return;
-            }
+            newJobs.push_back(*iter);
          }
-         cb = m_callback;
       }
-      if(cb) cb->adding(getSharedFromThis(), job);
-      
-      job->ready();
-      m_jobQueueMutex.lock();
-      m_jobQueue.push_back(job);
-      m_jobQueueMutex.unlock();
+      cb = m_callback;
    }
-   if(cb)
+
+   std::unique_lock<std::mutex> lock(m_jobQueueMutex);
+   while(!newJobs.empty())
    {
-      cb->added(getSharedFromThis(), job);
+      // take the part that fits and reserve its slots so the jobs are only
+      // announced and made ready once they are sure to be queued
+      std::size_t count = newJobs.size();
+      if(!ignoreCapacity&&(m_capacity > 0))
+      {
+         // released, the jobs that do not fit are left untouched
+         if(!waitForSpace(lock, true, 0)) break;
+         count = std::min(count, m_capacity - (m_jobIndex.size() + m_reservedCount));
+      }
+      multiJob::List part;
+      multiJob::List::iterator last = newJobs.begin();
+      std::advance(last, count);
+      part.splice(part.end(), newJobs, newJobs.begin(), last);
+      m_reservedCount += count;
+      lock.unlock();
+
+      if(cb) cb->addingBatch(getSharedFromThis(), part);
+      for(multiJob::List::iterator iter = part.begin();iter != part.end();++iter)
+      {
+         (*iter)->ready();
+      }
+
+      lock.lock();
+      m_reservedCount -= count;
+      std::size_t skipped = 0;
+      multiJob::List::iterator iter = part.begin();
+      while(iter != part.end())
+      {
+         // checked again since the lock was released for the callback
+         if(m_jobIndex.find(iter->get()) == m_jobIndex.end())
+         {
+            pushJob(*iter);
+            ++iter;
+            ++result;
+         }
+         else
+         {
+            iter = part.erase(iter);
+            ++skipped;
+         }
+      }
+      if(skipped > 0) notifySpace(skipped);
+
+      // hand over what fits so consumers can make space for the rest
+      lock.unlock();
+      jobsAdded(cb, part);
+      lock.lock();
    }
-   m_block.set(true);
+
+   return result;
 }
 
 std::shared_ptr<multiJob> multiJobQueue::removeByName(const multiString& name)
@@ -145,15 +452,13 @@ std::shared_ptr<multiJob> multiJobQueue::removeByName(const multiString& name)
    if(name.empty()) return result;
    {
       std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-      multiJob::List::iterator iter = findByName(name);
-      if(iter!=m_jobQueue.end())
+      Position pos = findByName(name);
+      if(pos.band!=m_bands.end())
       {
-         result = *iter;
-         m_jobQueue.erase(iter);
+         result = eraseJob(pos);
       }
       cb = m_callback;
    }      
-   m_block.set(!m_jobQueue.empty());
    
    if(cb&&result)
    {
@@ -168,14 +473,12 @@ std::shared_ptr<multiJob> multiJobQueue::removeById(const multiString& id)
    if(id.empty()) return result;
    {
       std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-      multiJob::List::iterator iter = findById(id);
-      if(iter!=m_jobQueue.end())
+      Position pos = findById(id);
+      if(pos.band!=m_bands.end())
       {
-         result = *iter;
-         m_jobQueue.erase(iter);
+         result = eraseJob(pos);
       }
       cb = m_callback;
-      m_block.set(!m_jobQueue.empty());
    }
    if(cb&&result)
    {
@@ -190,11 +493,10 @@ void multiJobQueue::remove(const std::shared_ptr<multiJob> job)
    std::shared_ptr<Callback> cb;
    {
       std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-      multiJob::List::iterator iter = std::find(m_jobQueue.begin(), m_jobQueue.end(), job);
-      if(iter!=m_jobQueue.end())
+      Position pos = findByPointer(job);
+      if(pos.band!=m_bands.end())
       {
-         removedJob = (*iter);
-         m_jobQueue.erase(iter);
+         removedJob = eraseJob(pos);
       }
       cb = m_callback;
    }
@@ -204,6 +506,16 @@ void multiJobQueue::remove(const std::shared_ptr<multiJob> job)
    }
 }
 
+bool multiJobQueue::claim(const std::shared_ptr<multiJob>& job)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   Position pos = findByPointer(job);
+   if(pos.band == m_bands.end()) return false;
+   eraseJob(pos);
+
+   return true;
+}
+
 void multiJobQueue::removeStoppedJobs()
 {
    multiJob::List removedJobs;
@@ -211,19 +523,43 @@ void multiJobQueue::removeStoppedJobs()
    {
       std::lock_guard<std::mutex> lock(m_jobQueueMutex);
       cb = m_callback;
-      multiJob::List::iterator iter = m_jobQueue.begin();
-      while(iter!=m_jobQueue.end())
+      BandMap::iterator band = m_bands.begin();
+      while(band!=m_bands.end())
       {
-         if((*iter)->isStopped())
+         multiJob::List::iterator iter = band->second.begin();
+         while(iter!=band->second.end())
          {
-            removedJobs.push_back(*iter);
-            iter = m_jobQueue.erase(iter);
+            if((*iter)->isStopped())
+            {
+               JobIndex::iterator indexIter = findEntry(iter);
+               unindexKeys(iter->get(), indexIter->second);
+               --m_tenants[indexIter->second.tenant].depth;
+               bool linked = indexIter->second.linked;
+               m_arrivals.erase(indexIter->second.arrival);
+               m_jobIndex.erase(indexIter);
+               if(linked&&(m_jobIndex.find(iter->get()) == m_jobIndex.end()))
+               {
+                  (*iter)->setJobQueue(std::weak_ptr<multiJobQueue>());
+               }
+               removedJobs.push_back(*iter);
+               iter = band->second.erase(iter);
+            }
+            else 
+            {
+               ++iter;
+            }
          }
-         else 
+         if(band->second.empty())
          {
-            ++iter;
+            band = m_bands.erase(band);
+         }
+         else
+         {
+            ++band;
          }
       }
+      m_jobCount.store(m_jobIndex.size(), std::memory_order_relaxed);
+      notifySpace(removedJobs.size());
    }
    if(!removedJobs.empty())
    {
@@ -242,11 +578,31 @@ void multiJobQueue::removeStoppedJobs()
 
 void multiJobQueue::clear()
 {
-   multiJob::List removedJobs(m_jobQueue);
+   multiJob::List removedJobs;
    std::shared_ptr<Callback> cb;
    {
       std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-      m_jobQueue.clear();
+      for(BandMap::iterator band = m_bands.begin();band != m_bands.end();++band)
+      {
+         for(multiJob::List::iterator iter = band->second.begin();
+             iter != band->second.end();
+             ++iter)
+         {
+            if(findEntry(iter)->second.linked) (*iter)->setJobQueue(std::weak_ptr<multiJobQueue>());
+         }
+         removedJobs.splice(removedJobs.end(), band->second);
+      }
+      m_bands.clear();
+      m_jobIndex.clear();
+      m_arrivals.clear();
+      m_jobCount.store(0, std::memory_order_relaxed);
+      for(std::size_t idx = 0;idx < m_tenants.size();++idx)
+      {
+         m_tenants[idx].depth = 0;
+      }
+      m_idIndex.clear();
+      m_nameIndex.clear();
+      releaseSpaceWaiters();
       cb = m_callback;
    }
    if(cb)
@@ -260,137 +616,669 @@ void multiJobQueue::clear()
 
 std::shared_ptr<multiJob> multiJobQueue::nextJob(bool blockIfEmptyFlag)
 {
-   m_jobQueueMutex.lock();
-   bool emptyFlag = m_jobQueue.empty();
-   m_jobQueueMutex.unlock();
-   if (blockIfEmptyFlag && emptyFlag)
+   if (blockIfEmptyFlag)
    {
-      m_block.block();
+      waitForJobs();
    }
    
    std::shared_ptr<multiJob> result;
    std::lock_guard<std::mutex> lock(m_jobQueueMutex);
    
-   if (m_jobQueue.empty())
+   if (m_bands.empty())
    {
-      m_block.set(false);
+      m_releaseFlag = false;
       return result;
    }
    
-   multiJob::List::iterator iter= m_jobQueue.begin();
-   while((iter != m_jobQueue.end())&&
-         (((*iter)->isCanceled())))
+   multiJob::List jobs;
+   if(popJob(jobs))
    {
-      (*iter)->finished(); // mark the ob as being finished 
-      iter = m_jobQueue.erase(iter);
+      result = jobs.front();
+      jobs.front().reset();
+      keepSpareNode(jobs, jobs.begin());
    }
-   if(iter != m_jobQueue.end())
+
+   return result;
+}
+
+std::size_t multiJobQueue::nextJobs(std::size_t n, multiJob::List& jobs, bool blockIfEmptyFlag)
+{
+   std::size_t result = 0;
+   if(n < 1) return result;
+
+   if (blockIfEmptyFlag)
+   {
+      waitForJobs();
+   }
+
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   while((result < n)&&popJob(jobs))
    {
-      result = *iter;
-      m_jobQueue.erase(iter);
+      ++result;
    }
-   m_block.set(!m_jobQueue.empty());
+   if(result < 1) m_releaseFlag = false;
 
    return result;
 }
+
+void multiJobQueue::recycleNodes(multiJob::List& nodes)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   while(!nodes.empty())
+   {
+      nodes.front().reset();
+      keepSpareNode(nodes, nodes.begin());
+   }
+}
+
+void multiJobQueue::priorityChanged(std::shared_ptr<multiJob> job)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   if(m_orderingMode == PRIORITY_ORDERING) rebandJob(job);
+}
+
+void multiJobQueue::deadlineChanged(std::shared_ptr<multiJob> job)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   if(m_orderingMode == DEADLINE_ORDERING) rebandJob(job);
+}
+
+void multiJobQueue::nameChanged(std::shared_ptr<multiJob> job)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   std::pair<JobIndex::iterator, JobIndex::iterator> range = m_jobIndex.equal_range(job.get());
+   if(range.first == range.second) return;
+
+   multiString name = job->name();
+   for(JobIndex::iterator indexIter = range.first;indexIter != range.second;++indexIter)
+   {
+      IndexEntry& entry = indexIter->second;
+      if(name == entry.name) continue;
+      if(!entry.name.empty()) eraseKey(m_nameIndex, entry.name, job.get());
+      if(!name.empty()) m_nameIndex.insert(std::make_pair(name, job.get()));
+      entry.name = name;
+   }
+}
+
+void multiJobQueue::idChanged(std::shared_ptr<multiJob> job)
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   std::pair<JobIndex::iterator, JobIndex::iterator> range = m_jobIndex.equal_range(job.get());
+   if(range.first == range.second) return;
+
+   multiString id = job->id();
+   for(JobIndex::iterator indexIter = range.first;indexIter != range.second;++indexIter)
+   {
+      IndexEntry& entry = indexIter->second;
+      if(id == entry.id) continue;
+      if(!entry.id.empty()) eraseKey(m_idIndex, entry.id, job.get());
+      if(!id.empty()) m_idIndex.insert(std::make_pair(id, job.get()));
+      entry.id = id;
+   }
+}
+
 void multiJobQueue::releaseBlock()
 {
-   m_block.release();
+   m_releaseFlag = true;
+   m_jobEvent.notifyAll();
+}
+
+void multiJobQueue::wakeConsumer()
+{
+   m_jobEvent.notify(1);
+}
+
+void multiJobQueue::releaseProducers()
+{
+   std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+   releaseSpaceWaiters();
 }
 bool multiJobQueue::isEmpty()const
 {
    // std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-   // return m_jobQueue.empty();
+   // return m_bands.empty();
    m_jobQueueMutex.lock();
-   bool result =  m_jobQueue.empty();
+   bool result =  m_bands.empty();
    m_jobQueueMutex.unlock();
    return result;
 }
 
+bool multiJobQueue::isEmptyHint()const
+{
+   return (m_jobCount.load(std::memory_order_relaxed) == 0);
+}
+
 unsigned int multiJobQueue::size()
 {
    std::lock_guard<std::mutex> lock(m_jobQueueMutex);
-   return (unsigned int) m_jobQueue.size();
+   return (unsigned int) m_jobIndex.size();
 }
 
-multiJob::List::iterator multiJobQueue::findById(const multiString& id)
+unsigned long long multiJobQueue::deadlineMissCount()const
 {
-   if(id.empty()) return m_jobQueue.end();
-   multiJob::List::iterator iter = m_jobQueue.begin();
-   while(iter != m_jobQueue.end())
+   return m_deadlineMissCount.load(std::memory_order_relaxed);
+}
+
+unsigned long long multiJobQueue::oldestJobWaitMillis()
+{
+   std::chrono::steady_clock::time_point oldest;
+   {
+      std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+      if(m_arrivals.empty()) return 0;
+      oldest = m_arrivals.front();
+   }
+   return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - oldest).count();
+}
+
+double multiJobQueue::bandKey(const std::shared_ptr<multiJob>& job, const IndexEntry& entry)const
+{
+   double result = 0.0;
+   if(m_orderingMode == PRIORITY_ORDERING)
    {
-      if(id == (*iter)->id())
+      // lower keys are dispatched first.  With aging the effective priority
+      // at time t is p + r*(t - queued) = r*t - (r*queued - p), so ordering
+      // by r*queued - p gives the highest effective priority at any time
+      result = -job->priority();
+      if(m_priorityAging > 0.0)
       {
-         return iter;
+         result += m_priorityAging*std::chrono::duration<double>(entry.queuedTime.time_since_epoch()).count();
       }
-      ++iter;
-   }  
-   return m_jobQueue.end();
+   }
+   else if(m_orderingMode == DEADLINE_ORDERING)
+   {
+      result = job->hasDeadline()?
+         std::chrono::duration<double>(job->deadline().time_since_epoch()).count():
+         std::numeric_limits<double>::infinity();
+   }
+   else if(m_orderingMode == FAIR_SHARE_ORDERING)
+   {
+      // one band per tenant.  The tenant is resolved when the job is indexed
+      result = double(entry.tenant);
+   }
+   return result;
 }
 
-multiJob::List::iterator multiJobQueue::findByName(const multiString& name)
+bool multiJobQueue::addJob(std::shared_ptr<multiJob> job,
+                           bool uniqueFlag,
+                           bool waitIfFull,
+                           const std::chrono::steady_clock::time_point* deadline)
 {
-   if(name.empty()) return m_jobQueue.end();
-   multiJob::List::iterator iter = m_jobQueue.begin();
-   while(iter != m_jobQueue.end())
+   std::shared_ptr<Callback> cb;
    {
-      if(name == (*iter)->name())
+      std::unique_lock<std::mutex> lock(m_jobQueueMutex);
+      if(uniqueFlag&&(m_jobIndex.find(job.get()) != m_jobIndex.end()))
       {
-         return iter;
+         return false;
       }
-      ++iter;
-   }  
-   return m_jobQueue.end();
+      if(!waitForSpace(lock, waitIfFull, deadline)) return false;
+      // reserve the slot so it is still ours once the adding callback returns
+      ++m_reservedCount;
+      cb = m_callback;
+   }
+   if(cb) cb->adding(getSharedFromThis(), job);
+   
+   job->ready();
+   bool added = false;
+   {
+      std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+      --m_reservedCount;
+      // checked again since the lock was released for the callback
+      added = (!uniqueFlag||(m_jobIndex.find(job.get()) == m_jobIndex.end()));
+      if(added)
+      {
+         pushJob(job);
+      }
+      else
+      {
+         notifySpace(1);
+      }
+   }
+   if(!added)
+   {
+      return false;
+   }
+   if(cb)
+   {
+      cb->added(getSharedFromThis(), job);
+   }
+   m_jobEvent.notify(1);
+   return true;
 }
 
-multiJob::List::iterator multiJobQueue::findByPointer(const std::shared_ptr<multiJob> job)
+void multiJobQueue::jobsAdded(std::shared_ptr<Callback> cb, const multiJob::List& jobs)
 {
-   return std::find(m_jobQueue.begin(),
-                    m_jobQueue.end(),
-                    job);
+   if(jobs.empty()) return;
+   if(cb)
+   {
+      cb->addedBatch(getSharedFromThis(), jobs);
+   }
+   m_jobEvent.notify(jobs.size());
 }
 
-multiJob::List::iterator multiJobQueue::findByNameOrPointer(const std::shared_ptr<multiJob> job)
+void multiJobQueue::waitForJobs()
 {
-   multiString n = job->name();
-   multiJob::List::iterator iter = std::find_if(m_jobQueue.begin(), m_jobQueue.end(), [n, job](const std::shared_ptr<multiJob> jobIter){
-      bool result = (jobIter == job);
-      if(!result&&!n.empty()) result = jobIter->name() == n;
-      return result;
+   if(m_releaseFlag) return;
+   multi::EventCount::Key key = m_jobEvent.prepareWait();
+   bool emptyFlag = true;
+   {
+      std::lock_guard<std::mutex> lock(m_jobQueueMutex);
+      emptyFlag = m_bands.empty();
+   }
+   if(!emptyFlag || m_releaseFlag)
+   {
+      m_jobEvent.cancelWait();
+      return;
+   }
+   m_jobEvent.wait(key);
+}
+
+bool multiJobQueue::isFull()const
+{
+   return (m_capacity > 0)&&((m_jobIndex.size() + m_reservedCount) >= m_capacity);
+}
+
+bool multiJobQueue::waitForSpace(std::unique_lock<std::mutex>& lock,
+                                 bool waitIfFull,
+                                 const std::chrono::steady_clock::time_point* deadline)
+{
+   if(!isFull()) return true;
+   if(!waitIfFull) return false;
+
+   std::size_t releaseCount = m_spaceReleaseCount;
+   ++m_spaceWaitCount;
+   if(deadline)
+   {
+      m_spaceCondition.wait_until(lock, *deadline, [this, releaseCount]{
+         return (!isFull()||(m_spaceReleaseCount != releaseCount));
+      });
+   }
+   else
+   {
+      m_spaceCondition.wait(lock, [this, releaseCount]{
+         return (!isFull()||(m_spaceReleaseCount != releaseCount));
+      });
+   }
+   --m_spaceWaitCount;
+   return (!isFull()&&(m_spaceReleaseCount == releaseCount));
+}
+
+void multiJobQueue::releaseSpaceWaiters()
+{
+   ++m_spaceReleaseCount;
+   if(m_spaceWaitCount > 0) m_spaceCondition.notify_all();
+}
+
+void multiJobQueue::notifySpace(std::size_t count)
+{
+   if(m_spaceWaitCount < 1) return;
+   if(count >= m_spaceWaitCount)
+   {
+      m_spaceCondition.notify_all();
+   }
+   else
+   {
+      for(std::size_t idx = 0; idx < count; ++idx)
+      {
+         m_spaceCondition.notify_one();
+      }
+   }
+}
+
+std::size_t multiJobQueue::tenantIndex(const multiString& tenant)
+{
+   std::unordered_map<multiString, std::size_t>::iterator iter = m_tenantIndex.find(tenant);
+   if(iter != m_tenantIndex.end()) return iter->second;
+
+   TenantStats stats;
+   stats.tenant     = tenant;
+   stats.weight     = 1;
+   stats.depth      = 0;
+   stats.dispatched = 0;
+   m_tenants.push_back(stats);
+   m_tenantIndex.insert(std::make_pair(tenant, m_tenants.size()-1));
+   return m_tenants.size()-1;
+}
+
+multiJobQueue::BandMap::iterator multiJobQueue::nextBand()
+{
+   if(m_orderingMode != FAIR_SHARE_ORDERING) return m_bands.begin();
+
+   // deficit round robin with a cost of one per job.  The tenant keeps the
+   // turn until it used its weight or ran out of jobs, then the next band in
+   // key order takes over.
+   BandMap::iterator band = m_bands.lower_bound(double(m_fairTenant));
+   bool current = (band != m_bands.end())&&(band->first == double(m_fairTenant));
+   if(current&&(m_fairCredit > 0)) return band;
+   if(current) ++band;
+   if(band == m_bands.end()) band = m_bands.begin();
+   m_fairTenant = std::size_t(band->first);
+   m_fairCredit = m_tenants[m_fairTenant].weight;
+   return band;
+}
+
+void multiJobQueue::rebandJob(const std::shared_ptr<multiJob>& job)
+{
+   std::pair<JobIndex::iterator, JobIndex::iterator> range = m_jobIndex.equal_range(job.get());
+
+   // splice keeps the list node so no allocation is needed for the move.
+   // The current key is used so racing updates converge.
+   for(JobIndex::iterator indexIter = range.first;indexIter != range.second;++indexIter)
+   {
+      IndexEntry& entry = indexIter->second;
+      Position& pos = entry.position;
+      BandMap::iterator newBand = m_bands.insert(std::make_pair(bandKey(job, entry), multiJob::List())).first;
+      if(newBand != pos.band)
+      {
+         // the job goes behind the jobs queued before it, not to the end, so
+         // every band stays in queue order and its head is its oldest job
+         multiJob::List& band = newBand->second;
+         multiJob::List::iterator before = band.end();
+         while(before != band.begin())
+         {
+            multiJob::List::iterator previous = before;
+            --previous;
+            JobIndex::const_iterator previousEntry = findEntry(previous);
+            if((previousEntry != m_jobIndex.end())&&
+               (previousEntry->second.sequence < entry.sequence))
+            {
+               break;
+            }
+            before = previous;
+         }
+         band.splice(before, pos.band->second, pos.iter);
+         if(pos.band->second.empty()) m_bands.erase(pos.band);
+         pos.band = newBand;
+      }
+   }
+}
+
+void multiJobQueue::rebandAll()
+{
+   // taken in queue order so each band is rebuilt in queue order
+   std::vector<JobIndex::iterator> entries;
+   entries.reserve(m_jobIndex.size());
+   for(JobIndex::iterator iter = m_jobIndex.begin();iter != m_jobIndex.end();++iter)
+   {
+      entries.push_back(iter);
+   }
+   std::sort(entries.begin(), entries.end(), [](const JobIndex::iterator& a, const JobIndex::iterator& b){
+      return a->second.sequence < b->second.sequence;
    });
-   // multiJob::List::iterator iter = m_jobQueue.begin();
-   // while(iter != m_jobQueue.end())
-   // {
-   //    if((*iter) == job)
-   //    {
-   //       return iter;
-   //    }
-   //    else if((!n.empty())&&
-   //            (job->name() == (*iter)->name()))
-   //    {
-   //       return iter;
-   //    }
-   //    ++iter;
-//   }  
-   
-   return iter;
+
+   BandMap bands(m_bands.key_comp(), m_bands.get_allocator());
+   bands.swap(m_bands);
+   for(std::size_t idx = 0;idx < entries.size();++idx)
+   {
+      IndexEntry& entry = entries[idx]->second;
+      Position& pos = entry.position;
+      BandMap::iterator newBand = m_bands.insert(std::make_pair(bandKey(*pos.iter, entry), multiJob::List())).first;
+      newBand->second.splice(newBand->second.end(), pos.band->second, pos.iter);
+      pos.band = newBand;
+   }
 }
 
-bool multiJobQueue::hasJob(std::shared_ptr<multiJob> job)
+void multiJobQueue::pushJob(const std::shared_ptr<multiJob>& job)
+{
+   IndexEntry& entry = m_jobIndex.insert(std::make_pair(job.get(), IndexEntry()))->second;
+   entry.sequence = m_sequence++;
+   bool keysFlag = job->hasKeys();
+
+   // record the queue before reading the priority, name and id so a
+   // concurrent change either lands before they are read or notifies
+   // us afterwards.  Every job is linked since a name or id set while it
+   // waits has to reach the indexes
+   entry.linked = linkJob(job);
+   multiString tenant;
+   if(keysFlag) job->keys(entry.name, entry.id, tenant);
+   entry.tenant = tenant.empty()?0:tenantIndex(tenant);
+   entry.queuedTime = std::chrono::steady_clock::now();
+   entry.arrival = m_arrivals.insert(m_arrivals.end(), entry.queuedTime);
+   ++m_tenants[entry.tenant].depth;
+   entry.position.band = m_bands.insert(std::make_pair(bandKey(job, entry), multiJob::List())).first;
+   multiJob::List& band = entry.position.band->second;
+   if(m_spareNodes.empty())
+   {
+      entry.position.iter = band.insert(band.end(), job);
+   }
+   else
+   {
+      entry.position.iter = m_spareNodes.begin();
+      band.splice(band.end(), m_spareNodes, entry.position.iter);
+      *entry.position.iter = job;
+   }
+   if(!entry.name.empty()) m_nameIndex.insert(std::make_pair(entry.name, job.get()));
+   if(!entry.id.empty())   m_idIndex.insert(std::make_pair(entry.id, job.get()));
+   m_jobCount.store(m_jobIndex.size(), std::memory_order_relaxed);
+}
+
+bool multiJobQueue::linkJob(const std::shared_ptr<multiJob>& job)
 {
-   multiJob::List::const_iterator iter = m_jobQueue.begin();
-   while(iter != m_jobQueue.end())
+   if(m_self.expired())
    {
-      if(job == (*iter))
+      // a queue that is not owned by a shared_ptr can not be linked to
+      try
       {
+         m_self = shared_from_this();
+      }
+      catch(const std::bad_weak_ptr&)
+      {
+         return false;
+      }
+   }
+   job->setJobQueue(m_self);
+   return true;
+}
+
+void multiJobQueue::keepSpareNode(multiJob::List& list, multiJob::List::iterator node)
+{
+   // enough nodes for a full bounded queue, but a burst on an unbounded
+   // queue does not keep its peak for good
+   static const std::size_t MAX_SPARE_NODES = 1024;
+   std::size_t limit = MAX_SPARE_NODES;
+   if(m_capacity > limit) limit = m_capacity;
+   if(m_spareNodes.size() < limit)
+   {
+      m_spareNodes.splice(m_spareNodes.end(), list, node);
+   }
+   else
+   {
+      list.erase(node);
+   }
+}
+
+void multiJobQueue::unindexKeys(const multiJob* job, const IndexEntry& entry)
+{
+   if(!entry.name.empty()) eraseKey(m_nameIndex, entry.name, job);
+   if(!entry.id.empty())   eraseKey(m_idIndex, entry.id, job);
+}
+
+void multiJobQueue::eraseKey(KeyIndex& index, const multiString& key, const multiJob* job)
+{
+   std::pair<KeyIndex::iterator, KeyIndex::iterator> range = index.equal_range(key);
+   for(KeyIndex::iterator iter = range.first;iter != range.second;++iter)
+   {
+      if(iter->second == job)
+      {
+         index.erase(iter);
+         return;
+      }
+   }
+}
+
+bool multiJobQueue::popJob(multiJob::List& jobs)
+{
+   // the clock is read up front for aging and wait statistics in priority
+   // mode, otherwise only once a job with a deadline comes up
+   std::chrono::steady_clock::time_point now;
+   bool priorityFlag = (m_orderingMode == PRIORITY_ORDERING);
+   bool hasNow       = priorityFlag;
+   if(hasNow) now = std::chrono::steady_clock::now();
+   while(!m_bands.empty())
+   {
+      Position pos;
+      pos.band = nextBand();
+      pos.iter = pos.band->second.begin();
+      const std::shared_ptr<multiJob>& job = *pos.iter;
+      if(job->hasDeadline()&&!hasNow)
+      {
+         now     = std::chrono::steady_clock::now();
+         hasNow  = true;
+      }
+      if(job->isCanceled())
+      {
+         eraseJob(pos)->finished(); // mark the job as being finished 
+      }
+      else if(hasNow&&job->isExpired(now))
+      {
+         m_deadlineMissCount.fetch_add(1, std::memory_order_relaxed);
+         std::shared_ptr<multiJob> expired = eraseJob(pos);
+         expired->cancel();
+         expired->finished();
+      }
+      else
+      {
+         if(priorityFlag)
+         {
+            JobIndex::const_iterator indexIter = findEntry(pos.iter);
+            if(indexIter != m_jobIndex.end())
+            {
+               unsigned long long waited =
+                  std::chrono::duration_cast<std::chrono::milliseconds>(now - indexIter->second.queuedTime).count();
+               // bounded by the configured bands, not one entry per priority
+               std::vector<double>::const_iterator band =
+                  std::upper_bound(m_waitStatsBands.begin(), m_waitStatsBands.end(), job->priority());
+               if(band != m_waitStatsBands.begin()) --band;
+               unsigned long long& maxWait = m_maxWaitMillis[*band];
+               maxWait = std::max(maxWait, waited);
+            }
+         }
+         if(m_fairCredit > 0) --m_fairCredit;
+         eraseJob(pos, &jobs);
          return true;
       }
-      ++iter;
    }
-   
    return false;
 }
 
+std::shared_ptr<multiJob> multiJobQueue::eraseJob(const Position& pos, multiJob::List* dest)
+{
+   std::shared_ptr<multiJob> result = *pos.iter;
+   JobIndex::iterator indexIter = findEntry(pos.iter);
+   if(indexIter != m_jobIndex.end())
+   {
+      unindexKeys(result.get(), indexIter->second);
+      TenantStats& stats = m_tenants[indexIter->second.tenant];
+      --stats.depth;
+      // only dispatched jobs are moved to a destination list
+      if(dest) ++stats.dispatched;
+      bool linked = indexIter->second.linked;
+      m_arrivals.erase(indexIter->second.arrival);
+      m_jobIndex.erase(indexIter);
+      m_jobCount.store(m_jobIndex.size(), std::memory_order_relaxed);
+
+      // a job queued more than once stays linked until its last entry goes
+      if(linked&&(m_jobIndex.find(result.get()) == m_jobIndex.end()))
+      {
+         result->setJobQueue(std::weak_ptr<multiJobQueue>());
+      }
+   }
+   notifySpace(1);
+   if(dest)
+   {
+      dest->splice(dest->end(), pos.band->second, pos.iter);
+   }
+   else
+   {
+      pos.iter->reset();
+      keepSpareNode(pos.band->second, pos.iter);
+   }
+   if(pos.band->second.empty())
+   {
+      m_bands.erase(pos.band);
+   }
+   return result;
+}
+
+multiJobQueue::JobIndex::iterator multiJobQueue::findEntry(const multiJob::List::iterator& node)
+{
+   std::pair<JobIndex::iterator, JobIndex::iterator> range = m_jobIndex.equal_range(node->get());
+   for(JobIndex::iterator iter = range.first;iter != range.second;++iter)
+   {
+      if(iter->second.position.iter == node) return iter;
+   }
+   return m_jobIndex.end();
+}
+
+multiJobQueue::JobIndex::iterator multiJobQueue::earliestEntry(const multiJob* job)
+{
+   std::pair<JobIndex::iterator, JobIndex::iterator> range = m_jobIndex.equal_range(job);
+   JobIndex::iterator result = (range.first != range.second)?range.first:m_jobIndex.end();
+   for(JobIndex::iterator iter = range.first;iter != range.second;++iter)
+   {
+      if(iter->second.sequence < result->second.sequence) result = iter;
+   }
+   return result;
+}
+
+multiJobQueue::Position multiJobQueue::findByKey(const KeyIndex& index, const multiString& key)
+{
+   Position result;
+   result.band = m_bands.end();
+   if(key.empty()) return result;
+
+   // the key index is unordered so every job with the key is looked at
+   JobIndex::iterator earliest = m_jobIndex.end();
+   std::pair<KeyIndex::const_iterator, KeyIndex::const_iterator> range = index.equal_range(key);
+   for(KeyIndex::const_iterator iter = range.first;iter != range.second;++iter)
+   {
+      JobIndex::iterator entry = earliestEntry(iter->second);
+      if((entry != m_jobIndex.end())&&
+         ((earliest == m_jobIndex.end())||(entry->second.sequence < earliest->second.sequence)))
+      {
+         earliest = entry;
+      }
+   }
+   if(earliest != m_jobIndex.end()) result = earliest->second.position;
+   return result;
+}
+
+multiJobQueue::Position multiJobQueue::findById(const multiString& id)
+{
+   return findByKey(m_idIndex, id);
+}
+
+multiJobQueue::Position multiJobQueue::findByName(const multiString& name)
+{
+   return findByKey(m_nameIndex, name);
+}
+
+multiJobQueue::Position multiJobQueue::findByPointer(const std::shared_ptr<multiJob> job)
+{
+   Position result;
+   result.band = m_bands.end();
+   JobIndex::iterator iter = earliestEntry(job.get());
+   if(iter != m_jobIndex.end())
+   {
+      result = iter->second.position;
+   }
+   return result;
+}
+
+multiJobQueue::Position multiJobQueue::findByNameOrPointer(const std::shared_ptr<multiJob> job)
+{
+   Position result = findByPointer(job);
+   if(result.band == m_bands.end())
+   {
+      result = findByName(job->name());
+   }
+   return result;
+}
+
+bool multiJobQueue::hasJob(std::shared_ptr<multiJob> job)
+{
+   return (m_jobIndex.find(job.get()) != m_jobIndex.end());
+}
+
 void multiJobQueue::setCallback(std::shared_ptr<Callback> c)
 {
    std::lock_guard<std::mutex> lock(m_jobQueueMutex);
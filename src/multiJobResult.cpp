@@ -0,0 +1,70 @@
+#include <multiJobResult.h>
+#include <chrono>
+
+multi::JobResultStateBase::JobResultStateBase()
+:m_ready(false),
+ m_waitCount(0)
+{
+}
+
+multi::JobResultStateBase::~JobResultStateBase()
+{
+}
+
+void multi::JobResultStateBase::wait()
+{
+   if(isReady()) return;
+   std::unique_lock<std::mutex> lock(m_mutex);
+   ++m_waitCount;
+   m_condition.wait(lock, [this]{return m_ready.load(std::memory_order_relaxed);});
+   --m_waitCount;
+}
+
+bool multi::JobResultStateBase::waitFor(unsigned long long waitTimeMillis)
+{
+   if(isReady()) return true;
+   std::unique_lock<std::mutex> lock(m_mutex);
+   ++m_waitCount;
+   bool result = m_condition.wait_for(lock,
+                                      std::chrono::milliseconds(waitTimeMillis),
+                                      [this]{return m_ready.load(std::memory_order_relaxed);});
+   --m_waitCount;
+   return result;
+}
+
+void multi::JobResultStateBase::setException(std::exception_ptr exception)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   if(m_ready.load(std::memory_order_relaxed)) return;
+   m_exception = exception;
+   complete(lock);
+}
+
+void multi::JobResultStateBase::addContinuation(std::function<void()> continuation)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_ready.load(std::memory_order_relaxed))
+      {
+         m_continuations.push_back(continuation);
+         return;
+      }
+   }
+   continuation();
+}
+
+void multi::JobResultStateBase::complete(std::unique_lock<std::mutex>& lock)
+{
+   m_ready.store(true, std::memory_order_release);
+   bool wakeFlag = (m_waitCount > 0);
+   std::vector<std::function<void()> > continuations;
+   continuations.swap(m_continuations);
+   lock.unlock();
+
+   // only the threads waiting on this result are woken
+   if(wakeFlag) m_condition.notify_all();
+   for(auto& continuation:continuations)
+   {
+      continuation();
+   }
+}
@@ -0,0 +1,516 @@
+#include <multiJobRingQueue.h>
+#include <new>
+#include <cstdint>
+
+/**
+* multiJobRingQueue is a fixed capacity job queue backed by a lock-free
+* multi-producer multi-consumer ring of sequence numbered slots.
+**/
+
+multiJobRingQueue::multiJobRingQueue(std::size_t capacity)
+:multiJobQueue(FIFO_ORDERING),
+ m_slotBuffer(0),
+ m_slots(0),
+ m_mask(0),
+ m_enqueuePos(0),
+ m_dequeuePos(0),
+ m_consumerWaitCount(0),
+ m_producerWaitCount(0),
+ m_releaseCount(0),
+ m_wakeCount(0),
+ m_spaceReleaseCount(0),
+ m_released(false),
+ m_hasCallback(false),
+ m_overflowCount(0)
+{
+   std::size_t size = 2;
+   while(size < capacity) size <<= 1;
+   m_mask = size - 1;
+
+   // align the slots to a cache line so each slot has a line of its own
+   m_slotBuffer = new char[size*sizeof(Slot) + CACHE_LINE_SIZE];
+   std::size_t offset = reinterpret_cast<std::uintptr_t>(m_slotBuffer)%CACHE_LINE_SIZE;
+   m_slots = reinterpret_cast<Slot*>(m_slotBuffer + (offset?(CACHE_LINE_SIZE - offset):0));
+   for(std::size_t idx = 0; idx < size; ++idx)
+   {
+      new(&m_slots[idx]) Slot();
+      m_slots[idx].m_sequence.store(idx, std::memory_order_relaxed);
+   }
+}
+
+multiJobRingQueue::~multiJobRingQueue()
+{
+   for(std::size_t idx = 0; idx <= m_mask; ++idx)
+   {
+      m_slots[idx].~Slot();
+   }
+   delete [] m_slotBuffer;
+}
+
+bool multiJobRingQueue::add(std::shared_ptr<multiJob> job, bool /*guaranteeUniqueFlag*/)
+{
+   return addToRing(job, true, 0);
+}
+
+bool multiJobRingQueue::tryAdd(std::shared_ptr<multiJob> job)
+{
+   return addToRing(job, false, 0);
+}
+
+bool multiJobRingQueue::addFor(std::shared_ptr<multiJob> job, unsigned long long waitTimeMillis)
+{
+   std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+
+                                                    std::chrono::milliseconds(waitTimeMillis);
+   return addToRing(job, true, &deadline);
+}
+
+std::size_t multiJobRingQueue::addAll(const multiJob::List& jobs, bool ignoreCapacity)
+{
+   // slots are claimed for up to MAX_PART jobs before the callback and the
+   // ready state change so a job that is not queued is left untouched
+   static const std::size_t MAX_PART = 32;
+   std::size_t result = 0;
+   std::shared_ptr<Callback> cb;
+   if(m_hasCallback.load(std::memory_order_acquire)) cb = callback();
+
+   multiJob::List::const_iterator iter = jobs.begin();
+   while(iter != jobs.end())
+   {
+      std::size_t positions[MAX_PART];
+      const std::shared_ptr<multiJob>* claimed[MAX_PART];
+      std::size_t count = 0;
+      bool overflow = false;
+      while((iter != jobs.end())&&(count < MAX_PART))
+      {
+         if(*iter)
+         {
+            if(!claimSlot(positions[count])) break;
+            claimed[count++] = &*iter;
+         }
+         ++iter;
+      }
+      if((count < 1)&&(iter != jobs.end()))
+      {
+         if(ignoreCapacity)
+         {
+            overflow = true;
+         }
+         else
+         {
+            std::unique_lock<std::mutex> lock(m_waitMutex);
+            unsigned int releaseCount = m_spaceReleaseCount.load();
+            bool added = false;
+            ++m_producerWaitCount;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_producerCondition.wait(lock, [this, &positions, &added, releaseCount]{
+               if(m_spaceReleaseCount.load() != releaseCount) return true;
+               added = claimSlot(positions[0]);
+               return added;
+            });
+            --m_producerWaitCount;
+
+            // released by releaseProducers or clear, the jobs that do not
+            // fit are not queued and the caller sees the count fall short
+            if(!added) break;
+         }
+         claimed[count++] = &*iter;
+         ++iter;
+      }
+      if(count < 1) continue;
+
+      multiJob::List part;
+      if(cb)
+      {
+         for(std::size_t idx = 0;idx < count;++idx) part.push_back(*claimed[idx]);
+         cb->addingBatch(getSharedFromThis(), part);
+      }
+      for(std::size_t idx = 0;idx < count;++idx)
+      {
+         const std::shared_ptr<multiJob>& job = *claimed[idx];
+         job->ready();
+         if(overflow)
+         {
+            std::lock_guard<std::mutex> lock(m_overflowMutex);
+            m_overflow.push_back(job);
+            m_overflowCount.fetch_add(1);
+         }
+         else
+         {
+            publish(positions[idx], job);
+         }
+         notifyConsumer();
+      }
+      result += count;
+      if(cb) cb->addedBatch(getSharedFromThis(), part);
+   }
+
+   return result;
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::removeByName(const multiString& /*name*/)
+{
+   return std::shared_ptr<multiJob>();
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::removeById(const multiString& /*id*/)
+{
+   return std::shared_ptr<multiJob>();
+}
+
+void multiJobRingQueue::remove(const std::shared_ptr<multiJob> /*job*/)
+{
+}
+
+bool multiJobRingQueue::claim(const std::shared_ptr<multiJob>& /*job*/)
+{
+   return false;
+}
+
+void multiJobRingQueue::removeStoppedJobs()
+{
+}
+
+void multiJobRingQueue::clear()
+{
+   releaseProducers();
+   multiJob::List removedJobs;
+   {
+      std::lock_guard<std::mutex> lock(m_overflowMutex);
+      removedJobs.swap(m_overflow);
+      m_overflowCount.store(0);
+   }
+   std::shared_ptr<multiJob> job;
+   while((job = dequeue()))
+   {
+      removedJobs.push_back(job);
+      notifyProducer();
+   }
+   std::shared_ptr<Callback> cb;
+   if(m_hasCallback.load(std::memory_order_acquire)) cb = callback();
+   if(cb)
+   {
+      for(multiJob::List::iterator iter=removedJobs.begin();iter!=removedJobs.end();++iter)
+      {
+         cb->removed(getSharedFromThis(), (*iter));
+      }
+   }
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::nextJob(bool blockIfEmptyFlag)
+{
+   std::shared_ptr<multiJob> result = dequeueReady();
+   if(!result&&blockIfEmptyFlag)
+   {
+      waitForJobs();
+      result = dequeueReady();
+   }
+   if(result) notifyProducer();
+   return result;
+}
+
+std::size_t multiJobRingQueue::nextJobs(std::size_t n, multiJob::List& jobs, bool blockIfEmptyFlag)
+{
+   std::size_t result = 0;
+   if(n < 1) return result;
+   std::shared_ptr<multiJob> job = nextJob(blockIfEmptyFlag);
+   if(!job) return result;
+
+   multiJob::List nodes;
+   {
+      std::lock_guard<std::mutex> lock(m_spareMutex);
+      multiJob::List::iterator last = m_spareBatchNodes.begin();
+      for(std::size_t idx = 0;(idx < n)&&(last != m_spareBatchNodes.end());++idx) ++last;
+      nodes.splice(nodes.end(), m_spareBatchNodes, m_spareBatchNodes.begin(), last);
+   }
+   while(job)
+   {
+      if(nodes.empty())
+      {
+         jobs.push_back(job);
+         job.reset();
+      }
+      else
+      {
+         nodes.front().swap(job);
+         jobs.splice(jobs.end(), nodes, nodes.begin());
+      }
+      ++result;
+      if(result >= n) break;
+      job = dequeueReady();
+      if(job) notifyProducer();
+   }
+   if(!nodes.empty()) recycleNodes(nodes);
+   return result;
+}
+
+void multiJobRingQueue::recycleNodes(multiJob::List& nodes)
+{
+   std::lock_guard<std::mutex> lock(m_spareMutex);
+   while(!nodes.empty()&&(m_spareBatchNodes.size() <= m_mask))
+   {
+      nodes.front().reset();
+      m_spareBatchNodes.splice(m_spareBatchNodes.end(), nodes, nodes.begin());
+   }
+   nodes.clear();
+}
+
+void multiJobRingQueue::releaseBlock()
+{
+   std::lock_guard<std::mutex> lock(m_waitMutex);
+   m_released = true;
+   ++m_releaseCount;
+   m_consumerCondition.notify_all();
+}
+
+void multiJobRingQueue::waitForJobs()
+{
+   std::unique_lock<std::mutex> lock(m_waitMutex);
+   if(!isEmpty()) return;
+
+   // a release issued while nobody was blocked is consumed by the next
+   // caller that finds the ring empty, just like multi::Block
+   if(m_released.exchange(false)) return;
+   unsigned int releaseCount = m_releaseCount.load();
+   unsigned int wakeCount = m_wakeCount.load();
+   ++m_consumerWaitCount;
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   m_consumerCondition.wait(lock, [this, releaseCount, wakeCount]{
+      return (!isEmpty()||(m_releaseCount.load() != releaseCount)||
+              (m_wakeCount.load() != wakeCount));
+   });
+   --m_consumerWaitCount;
+}
+
+bool multiJobRingQueue::isEmpty()const
+{
+   return ((m_dequeuePos.load(std::memory_order_acquire) >= 
+            m_enqueuePos.load(std::memory_order_acquire))&&
+           (m_overflowCount.load() == 0));
+}
+
+bool multiJobRingQueue::isEmptyHint()const
+{
+   return isEmpty();
+}
+
+unsigned int multiJobRingQueue::size()
+{
+   std::size_t dequeuePos = m_dequeuePos.load(std::memory_order_acquire);
+   std::size_t enqueuePos = m_enqueuePos.load(std::memory_order_acquire);
+   std::size_t result = (enqueuePos > dequeuePos)?(enqueuePos - dequeuePos):0;
+   if(result > (m_mask + 1)) result = m_mask + 1;
+   return (unsigned int) (result + m_overflowCount.load());
+}
+
+unsigned long long multiJobRingQueue::oldestJobWaitMillis()
+{
+   return 0;
+}
+
+void multiJobRingQueue::setOrderingMode(OrderingMode /*mode*/)
+{
+}
+
+void multiJobRingQueue::setCapacity(std::size_t /*capacity*/)
+{
+}
+
+std::size_t multiJobRingQueue::capacity()const
+{
+   return m_mask + 1;
+}
+
+void multiJobRingQueue::setCallback(std::shared_ptr<Callback> c)
+{
+   multiJobQueue::setCallback(c);
+   m_hasCallback.store(c != nullptr, std::memory_order_release);
+}
+
+bool multiJobRingQueue::enqueue(const std::shared_ptr<multiJob>& job)
+{
+   std::size_t pos = 0;
+   if(!claimSlot(pos)) return false;
+   publish(pos, job);
+   return true;
+}
+
+bool multiJobRingQueue::claimSlot(std::size_t& pos)
+{
+   pos = m_enqueuePos.load(std::memory_order_relaxed);
+   for(;;)
+   {
+      Slot* slot = &m_slots[pos & m_mask];
+      std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+      std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+      if(diff == 0)
+      {
+         if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return true;
+      }
+      else if(diff < 0)
+      {
+         // the slot still holds a job from the previous lap
+         return false;
+      }
+      else
+      {
+         pos = m_enqueuePos.load(std::memory_order_relaxed);
+      }
+   }
+}
+
+void multiJobRingQueue::publish(std::size_t pos, const std::shared_ptr<multiJob>& job)
+{
+   Slot* slot = &m_slots[pos & m_mask];
+   slot->m_job = job;
+   slot->m_sequence.store(pos + 1, std::memory_order_release);
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::dequeue()
+{
+   std::shared_ptr<multiJob> result;
+   Slot* slot = 0;
+   std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+   for(;;)
+   {
+      slot = &m_slots[pos & m_mask];
+      std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+      std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+      if(diff == 0)
+      {
+         if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      }
+      else if(diff < 0)
+      {
+         // the slot has not been filled for this lap
+         return result;
+      }
+      else
+      {
+         pos = m_dequeuePos.load(std::memory_order_relaxed);
+      }
+   }
+   result.swap(slot->m_job);
+   slot->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+   return result;
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::dequeueOverflow()
+{
+   std::shared_ptr<multiJob> result;
+   if(m_overflowCount.load() == 0) return result;
+   std::lock_guard<std::mutex> lock(m_overflowMutex);
+   if(!m_overflow.empty())
+   {
+      result.swap(m_overflow.front());
+      m_overflow.pop_front();
+      m_overflowCount.fetch_sub(1);
+   }
+   return result;
+}
+
+std::shared_ptr<multiJob> multiJobRingQueue::dequeueReady()
+{
+   std::shared_ptr<multiJob> result;
+   while((result = dequeueOverflow())||(result = dequeue()))
+   {
+      if(result->isCanceled())
+      {
+         result->finished(); // mark the job as being finished
+      }
+      else if(result->hasDeadline()&&result->isExpired(std::chrono::steady_clock::now()))
+      {
+         m_deadlineMissCount.fetch_add(1, std::memory_order_relaxed);
+         result->cancel();
+         result->finished();
+      }
+      else
+      {
+         break;
+      }
+      notifyProducer();
+   }
+   return result;
+}
+
+bool multiJobRingQueue::addToRing(const std::shared_ptr<multiJob>& job,
+                                  bool waitIfFull,
+                                  const std::chrono::steady_clock::time_point* deadline)
+{
+   std::size_t pos = 0;
+   bool result = claimSlot(pos);
+   if(!result&&waitIfFull)
+   {
+      std::unique_lock<std::mutex> lock(m_waitMutex);
+      unsigned int releaseCount = m_spaceReleaseCount.load();
+      ++m_producerWaitCount;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      // a released producer gives up before claiming a slot
+      auto claimed = [this, &pos, &result, releaseCount]{
+         if(m_spaceReleaseCount.load() != releaseCount) return true;
+         result = claimSlot(pos);
+         return result;
+      };
+      if(deadline)
+      {
+         m_producerCondition.wait_until(lock, *deadline, claimed);
+      }
+      else
+      {
+         m_producerCondition.wait(lock, claimed);
+      }
+      --m_producerWaitCount;
+   }
+   if(!result) return false;
+
+   std::shared_ptr<Callback> cb;
+   if(m_hasCallback.load(std::memory_order_acquire)) cb = callback();
+   if(cb) cb->adding(getSharedFromThis(), job);
+
+   job->ready();
+   publish(pos, job);
+   notifyConsumer();
+   if(cb) cb->added(getSharedFromThis(), job);
+
+   return true;
+}
+
+void multiJobRingQueue::notifyConsumer()
+{
+   // pairs with the fence in nextJob so either the consumer sees the job or
+   // we see the consumer waiting
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if(m_consumerWaitCount.load(std::memory_order_relaxed) > 0)
+   {
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      m_consumerCondition.notify_one();
+   }
+}
+
+void multiJobRingQueue::wakeConsumer()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if(m_consumerWaitCount.load(std::memory_order_relaxed) > 0)
+   {
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      ++m_wakeCount;
+      m_consumerCondition.notify_one();
+   }
+}
+
+void multiJobRingQueue::releaseProducers()
+{
+   std::lock_guard<std::mutex> lock(m_waitMutex);
+   ++m_spaceReleaseCount;
+   m_producerCondition.notify_all();
+}
+
+void multiJobRingQueue::notifyProducer()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if(m_producerWaitCount.load(std::memory_order_relaxed) > 0)
+   {
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      m_producerCondition.notify_one();
+   }
+}
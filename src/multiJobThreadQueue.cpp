@@ -1,7 +1,211 @@
 #include <multiJobThreadQueue.h>
 #include <cstddef> // for std::nullptr
+
+/**
+* WorkStealingDeque is a Chase-Lev work stealing deque of jobs.  Memory ordering
+* follows Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing
+* for Weak Memory Models".
+**/
+multi::WorkStealingDeque::Buffer::Buffer(std::int64_t capacity)
+:m_capacity(capacity),
+ m_mask(capacity-1),
+ m_slots(new std::atomic<Box>[capacity])
+{
+   for(std::int64_t idx = 0; idx < m_capacity; ++idx)
+   {
+      m_slots[idx].store(0, std::memory_order_relaxed);
+   }
+}
+
+multi::WorkStealingDeque::Buffer::~Buffer()
+{
+   delete [] m_slots;
+}
+
+multi::WorkStealingDeque::WorkStealingDeque(std::int64_t capacity)
+:m_top(0),
+ m_bottom(0),
+ m_buffer(0),
+ m_freeBoxes(0),
+ m_returnedBoxes(0)
+{
+   std::int64_t size = 2;
+   while(size < capacity) size <<= 1;
+   m_buffer.store(new Buffer(size), std::memory_order_relaxed);
+}
+
+multi::WorkStealingDeque::~WorkStealingDeque()
+{
+   Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+   std::int64_t top    = m_top.load(std::memory_order_relaxed);
+   std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+   for(std::int64_t idx = top; idx < bottom; ++idx)
+   {
+      delete buffer->get(idx);
+   }
+   delete buffer;
+   for(std::vector<Buffer*>::iterator iter = m_retiredBuffers.begin();
+       iter != m_retiredBuffers.end();
+       ++iter)
+   {
+      delete *iter;
+   }
+   deleteBoxes(m_freeBoxes);
+   deleteBoxes(m_returnedBoxes.load(std::memory_order_acquire));
+}
+
+void multi::WorkStealingDeque::push(std::shared_ptr<multiJob> job)
+{
+   std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+   std::int64_t top    = m_top.load(std::memory_order_acquire);
+   Buffer* buffer      = m_buffer.load(std::memory_order_relaxed);
+   if((bottom - top) > (buffer->m_capacity - 1))
+   {
+      buffer = grow(buffer, top, bottom);
+   }
+   buffer->put(bottom, allocateBox(job));
+   // publishes the box to thieves that acquire m_bottom
+   m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+std::shared_ptr<multiJob> multi::WorkStealingDeque::take()
+{
+   std::shared_ptr<multiJob> result;
+   std::int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+   Buffer* buffer      = m_buffer.load(std::memory_order_relaxed);
+   m_bottom.store(bottom, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   std::int64_t top = m_top.load(std::memory_order_relaxed);
+   if(top <= bottom)
+   {
+      Box box = buffer->get(bottom);
+      if(top == bottom)
+      {
+         // last job so race any thief for it
+         if(!m_top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+         {
+            box = 0;
+         }
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      }
+      if(box)
+      {
+         result.swap(box->m_job);
+         box->m_next = m_freeBoxes;
+         m_freeBoxes = box;
+      }
+   }
+   else
+   {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+   }
+   return result;
+}
+
+std::shared_ptr<multiJob> multi::WorkStealingDeque::steal()
+{
+   std::shared_ptr<multiJob> result;
+   std::int64_t top = m_top.load(std::memory_order_acquire);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   std::int64_t bottom = m_bottom.load(std::memory_order_acquire);
+   if(top < bottom)
+   {
+      Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+      Box box = buffer->get(top);
+      if(m_top.compare_exchange_strong(top, top + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+      {
+         result.swap(box->m_job);
+         returnBox(box);
+      }
+   }
+   return result;
+}
+
+bool multi::WorkStealingDeque::isEmpty()const
+{
+   return (size() < 1);
+}
+
+std::int64_t multi::WorkStealingDeque::size()const
+{
+   std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+   std::int64_t top    = m_top.load(std::memory_order_relaxed);
+   return (bottom > top)?(bottom - top):0;
+}
+
+multi::WorkStealingDeque::Buffer* multi::WorkStealingDeque::grow(Buffer* buffer, 
+                                                                 std::int64_t top, 
+                                                                 std::int64_t bottom)
+{
+   Buffer* result = new Buffer(buffer->m_capacity*2);
+   for(std::int64_t idx = top; idx < bottom; ++idx)
+   {
+      result->put(idx, buffer->get(idx));
+   }
+   m_retiredBuffers.push_back(buffer);
+   m_buffer.store(result, std::memory_order_release);
+   return result;
+}
+
+multi::WorkStealingDeque::Box multi::WorkStealingDeque::allocateBox(const std::shared_ptr<multiJob>& job)
+{
+   // only the owner pops so taking the whole returned list has no ABA problem
+   if(!m_freeBoxes) m_freeBoxes = m_returnedBoxes.exchange(0, std::memory_order_acquire);
+   Box result = m_freeBoxes;
+   if(result)
+   {
+      m_freeBoxes = result->m_next;
+      result->m_next = 0;
+   }
+   else
+   {
+      result = new JobBox();
+   }
+   result->m_job = job;
+   return result;
+}
+
+void multi::WorkStealingDeque::returnBox(Box box)
+{
+   box->m_next = m_returnedBoxes.load(std::memory_order_relaxed);
+   while(!m_returnedBoxes.compare_exchange_weak(box->m_next, box,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed))
+   {
+   }
+}
+
+void multi::WorkStealingDeque::deleteBoxes(Box box)
+{
+   while(box)
+   {
+      Box next = box->m_next;
+      delete box;
+      box = next;
+   }
+}
+
+namespace
+{
+   /**
+   * The job thread running on the calling thread
+   */
+   thread_local multiJobThreadQueue* t_currentThreadQueue = 0;
+}
+
 multiJobThreadQueue::multiJobThreadQueue(std::shared_ptr<multiJobQueue> jqueue)
-:m_doneFlag(false)
+:m_doneFlag(false),
+ m_stealIndex(0),
+ m_batchSize(1),
+ m_returnJobOnStop(false),
+ m_numaNode(-1),
+ m_lastJobTime(std::chrono::steady_clock::now()),
+ m_idleEstimate(0.0),
+ m_busyFlag(false)
 {
    setJobQueue(jqueue);    
 }
@@ -59,6 +263,7 @@ void multiJobThreadQueue::run()
    bool firstTime = true;
    bool validQueue = true;
    std::shared_ptr<multiJob> job;
+   t_currentThreadQueue = this;
    do
    {
       interrupt();
@@ -80,6 +285,7 @@ void multiJobThreadQueue::run()
          {            
             std::lock_guard<std::mutex> lock(m_threadMutex);
             m_currentJob = 0;
+            m_lastJobTime = std::chrono::steady_clock::now();
          }
          job.reset();
       }
@@ -97,9 +303,21 @@ void multiJobThreadQueue::run()
    }
    if(job&&m_doneFlag&&job->isReady())
    {
-      job->cancel();
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      if(m_returnJobOnStop)
+      {
+         // flushLocalJobs puts it back on the shared queue
+         m_batch.push_front(job);
+      }
+      else
+      {
+         job->cancel();
+      }
    }
    job = 0;
+   flushLocalJobs();
+   setBusy(false);
+   t_currentThreadQueue = 0;
 }
 
 void multiJobThreadQueue::setDone(bool done)
@@ -141,43 +359,56 @@ void multiJobThreadQueue::cancel()
 {
    
    if( isRunning() )
+   {
+      stop(true);
+      waitForStop();
+   }
+}
+
+void multiJobThreadQueue::stop(bool cancelCurrentJobFlag)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_doneFlag = true;
+   m_returnJobOnStop = !cancelCurrentJobFlag;
+   if (m_currentJob&&cancelCurrentJobFlag)
+   {
+      m_currentJob->cancel();
+   }
+   
+   if (m_jobQueue) 
+   {
+      m_jobQueue->releaseBlock();
+   }
+}
+
+void multiJobThreadQueue::waitForStop()
+{
+   // then wait for the the thread to stop running.
+   while(isRunning())
    {
       {
          std::lock_guard<std::mutex> lock(m_threadMutex);
-         m_doneFlag = true;
-         if (m_currentJob)
-         {
-            m_currentJob->cancel();
-         }
          
          if (m_jobQueue) 
          {
             m_jobQueue->releaseBlock();
          }
       }
-      
-      // then wait for the the thread to stop running.
-      while(isRunning())
-      {
-#if 1
-         {
-            std::lock_guard<std::mutex> lock(m_threadMutex);
-            
-            if (m_jobQueue) 
-            {
-               m_jobQueue->releaseBlock();
-            }
-         }
-#endif
-         multi::Thread::yieldCurrentThread();
-      }
+      multi::Thread::yieldCurrentThread();
    }
 }
 
+unsigned long long multiJobThreadQueue::idleMillis()const
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   if(m_currentJob) return 0;
+   return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_lastJobTime).count();
+}
+
 bool multiJobThreadQueue::isEmpty()const
 {
    std::lock_guard<std::mutex> lock(m_threadMutex);
-   return m_jobQueue->isEmpty();
+   return !m_jobQueue||m_jobQueue->isEmpty();
 }
 
 multiJobThreadQueue::~multiJobThreadQueue()
@@ -201,7 +432,10 @@ bool multiJobThreadQueue::hasJobsToProcess()const
    bool result = false;
    {
       std::lock_guard<std::mutex> lock(m_threadMutex);
-      result = (!m_jobQueue->isEmpty()||m_currentJob);
+      // the shared queue is checked first.  A job taken from it after that
+      // check was taken by a thread that was already marked busy.
+      result = (!m_jobQueue->isEmpty()||m_busyFlag||m_currentJob||!m_batch.empty()||
+                (m_localDeque&&!m_localDeque->isEmpty()));
    }
    
    return result;
@@ -212,11 +446,345 @@ std::shared_ptr<multiJob> multiJobThreadQueue::nextJob()
    std::shared_ptr<multiJob> job;
    m_threadMutex.lock();
    std::shared_ptr<multiJobQueue> jobQueue = m_jobQueue;
+   std::shared_ptr<multi::WorkStealingDeque> localDeque = m_localDeque;
    bool checkIfValid = !m_doneFlag&&jobQueue;
    m_threadMutex.unlock();
    if(checkIfValid)
    {
-      job = jobQueue->nextJob(true);
+      setBusy(true);
+      job = nextAvailableJob(jobQueue, localDeque);
+      if(!job) job = idleWait(jobQueue, localDeque);
    }
    return job;
 }
+
+std::shared_ptr<multiJob> multiJobThreadQueue::nextAvailableJob(std::shared_ptr<multiJobQueue> jobQueue,
+                                                                std::shared_ptr<multi::WorkStealingDeque> localDeque)
+{
+   std::shared_ptr<multiJob> job = nextBatchedJob();
+   if(job) return job;
+   if(localDeque)
+   {
+      // local work first, then the shared queue and then our peers
+      while((job = localDeque->take()))
+      {
+         if(!job->isCanceled()) return job;
+         job->finished();
+      }
+   }
+   job = nextQueuedJob(jobQueue, false);
+   if(!job&&localDeque) job = stealJob();
+   return job;
+}
+
+std::shared_ptr<multiJob> multiJobThreadQueue::idleWait(std::shared_ptr<multiJobQueue> jobQueue,
+                                                        std::shared_ptr<multi::WorkStealingDeque> localDeque)
+{
+   static const unsigned int MAX_PAUSE_COUNT = 64;
+   std::shared_ptr<multiJob> job;
+   multi::IdlePolicy policy = idlePolicy();
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   double budget = static_cast<double>(policy.spinMicros() + policy.yieldMicros());
+
+   if((budget > 0.0)&&(!policy.isAdaptive()||(m_idleEstimate <= budget)))
+   {
+      // spinning on a single processor only delays the thread that adds the job
+      static const bool spinFlag = (multi::Thread::getNumberOfProcessors() > 1);
+      std::chrono::steady_clock::time_point spinEnd  = start + std::chrono::microseconds(spinFlag?policy.spinMicros():0);
+      std::chrono::steady_clock::time_point yieldEnd = spinEnd + std::chrono::microseconds(policy.yieldMicros());
+      unsigned int pauseCount = 1;
+      while(!job&&!isDone())
+      {
+         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+         if(now >= yieldEnd) break;
+         if(now < spinEnd)
+         {
+            // back off between polls so spinning threads do not hammer the queue lock
+            for(unsigned int idx = 0; idx < pauseCount; ++idx)
+            {
+               multi::Thread::cpuRelax();
+            }
+            if(pauseCount < MAX_PAUSE_COUNT) pauseCount <<= 1;
+         }
+         else
+         {
+            multi::Thread::yieldCurrentThread();
+         }
+
+         // poll without the queue lock.  nextJob on an empty queue would take
+         // the lock and also consume a pending releaseBlock
+         if(!jobQueue->isEmptyHint())
+         {
+            job = nextAvailableJob(jobQueue, localDeque);
+         }
+         else if(localDeque)
+         {
+            job = stealJob();
+         }
+      }
+   }
+   if(!job&&!isDone())
+   {
+      setBusy(false);
+      jobQueue->waitForJobs();
+      setBusy(true);
+      job = nextAvailableJob(jobQueue, localDeque);
+      if(!job) setBusy(false);
+   }
+   if(job&&policy.isAdaptive())
+   {
+      double idleMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      m_idleEstimate += (idleMicros - m_idleEstimate)*0.25;
+   }
+
+   return job;
+}
+
+void multiJobThreadQueue::setIdleEvent(std::shared_ptr<multi::EventCount> idleEvent)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_idleEvent = idleEvent;
+}
+
+void multiJobThreadQueue::setBusy(bool busyFlag)
+{
+   if(busyFlag)
+   {
+      m_busyFlag = true;
+   }
+   else if(m_busyFlag.exchange(false))
+   {
+      std::shared_ptr<multi::EventCount> idleEvent;
+      {
+         std::lock_guard<std::mutex> lock(m_threadMutex);
+         idleEvent = m_idleEvent;
+      }
+      if(idleEvent) idleEvent->notifyAll();
+   }
+}
+
+void multiJobThreadQueue::setBatchSize(std::size_t batchSize)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_batchSize = (batchSize > 0)?batchSize:1;
+}
+
+std::size_t multiJobThreadQueue::batchSize()const
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   return m_batchSize;
+}
+
+void multiJobThreadQueue::setIdlePolicy(const multi::IdlePolicy& policy)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_idlePolicy = policy;
+}
+
+multi::IdlePolicy multiJobThreadQueue::idlePolicy()const
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   return m_idlePolicy;
+}
+
+std::shared_ptr<multiJob> multiJobThreadQueue::nextBatchedJob()
+{
+   std::shared_ptr<multiJob> job;
+   multiJob::List canceledJobs;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      while(!m_batch.empty())
+      {
+         if(!m_batch.front()->isCanceled())
+         {
+            // keep the node so the next claim can give it back to the queue
+            job.swap(m_batch.front());
+            m_spentBatchNodes.splice(m_spentBatchNodes.end(), m_batch, m_batch.begin());
+            break;
+         }
+         canceledJobs.splice(canceledJobs.end(), m_batch, m_batch.begin());
+      }
+   }
+
+   // finished runs the job callbacks, they must not be called with the thread
+   // mutex held
+   for(multiJob::List::iterator iter = canceledJobs.begin();iter != canceledJobs.end();++iter)
+   {
+      (*iter)->finished();
+   }
+   return job;
+}
+
+std::shared_ptr<multiJob> multiJobThreadQueue::nextQueuedJob(std::shared_ptr<multiJobQueue> jobQueue,
+                                                             bool blockIfEmptyFlag)
+{
+   std::size_t n = batchSize();
+   if(n < 2) return jobQueue->nextJob(blockIfEmptyFlag);
+
+   multiJob::List jobs;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      jobs.swap(m_spentBatchNodes);
+   }
+   if(!jobs.empty()) jobQueue->recycleNodes(jobs);
+   if(jobQueue->nextJobs(n, jobs, blockIfEmptyFlag))
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      m_batch.splice(m_batch.end(), jobs);
+   }
+   return nextBatchedJob();
+}
+
+void multiJobThreadQueue::setWorkStealing(std::shared_ptr<multi::WorkStealingDeque> localDeque,
+                                          std::shared_ptr<const DequeList> peers)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_localDeque = localDeque;
+   m_stealPeers = peers;
+}
+
+void multiJobThreadQueue::setStealPeers(std::shared_ptr<const DequeList> peers)
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   m_stealPeers = peers;
+}
+
+std::shared_ptr<multi::WorkStealingDeque> multiJobThreadQueue::localDeque()const
+{
+   std::lock_guard<std::mutex> lock(m_threadMutex);
+   return m_localDeque;
+}
+
+bool multiJobThreadQueue::pushLocal(std::shared_ptr<multiJob> job)
+{
+   if(t_currentThreadQueue != this) return false;
+   std::shared_ptr<multi::WorkStealingDeque> deque = localDeque();
+   if(!deque) return false;
+   job->ready();
+   deque->push(job);
+   return true;
+}
+
+bool multiJobThreadQueue::runPendingJob()
+{
+   if(t_currentThreadQueue != this) return false;
+   std::shared_ptr<multiJobQueue> jobQueue;
+   std::shared_ptr<multi::WorkStealingDeque> deque;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      jobQueue = m_jobQueue;
+      deque    = m_localDeque;
+   }
+   std::shared_ptr<multiJob> job;
+   if(deque)
+   {
+      while((job = deque->take()))
+      {
+         if(!job->isCanceled()) break;
+         job->finished();
+      }
+   }
+   if(!job&&jobQueue) job = nextAvailableJob(jobQueue, deque);
+   if(!job) return false;
+
+   // the waiting job stays the current job once the nested one returns
+   std::shared_ptr<multiJob> waitingJob;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      waitingJob   = m_currentJob;
+      m_currentJob = job;
+   }
+   if(job->isReady())
+   {
+      job->start();
+   }
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      m_currentJob = waitingJob;
+   }
+
+   return true;
+}
+
+multiJobThreadQueue* multiJobThreadQueue::currentThreadQueue()
+{
+   return t_currentThreadQueue;
+}
+
+void multiJobThreadQueue::setNumaNode(int node)
+{
+   m_numaNode = node;
+}
+
+int multiJobThreadQueue::numaNode()const
+{
+   return m_numaNode.load(std::memory_order_relaxed);
+}
+
+int multiJobThreadQueue::currentNumaNode()
+{
+   return t_currentThreadQueue?t_currentThreadQueue->numaNode():-1;
+}
+
+std::shared_ptr<multiJob> multiJobThreadQueue::stealJob()
+{
+   std::shared_ptr<multiJob> job;
+   std::shared_ptr<multi::WorkStealingDeque> localDeque;
+   std::shared_ptr<const DequeList> peers;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      localDeque = m_localDeque;
+      peers      = m_stealPeers;
+   }
+   if(!peers||peers->empty()) return job;
+
+   std::size_t nPeers = peers->size();
+   for(std::size_t count = 0; count < nPeers; ++count)
+   {
+      std::size_t idx = (m_stealIndex + count)%nPeers;
+      const std::shared_ptr<multi::WorkStealingDeque>& victim = (*peers)[idx];
+      if(!victim||(victim == localDeque)) continue;
+      while((job = victim->steal()))
+      {
+         if(!job->isCanceled())
+         {
+            // start with the same victim next time since it still had work
+            m_stealIndex = idx;
+            return job;
+         }
+         job->finished();
+      }
+   }
+   return job;
+}
+
+void multiJobThreadQueue::flushLocalJobs()
+{
+   std::shared_ptr<multi::WorkStealingDeque> localDeque;
+   std::shared_ptr<multiJobQueue> jobQueue;
+   multiJob::List jobs;
+   {
+      std::lock_guard<std::mutex> lock(m_threadMutex);
+      localDeque = m_localDeque;
+      jobQueue   = m_jobQueue;
+      jobs.swap(m_batch);
+   }
+   std::shared_ptr<multiJob> job;
+   while(localDeque&&(job = localDeque->take()))
+   {
+      jobs.push_back(job);
+   }
+   if(jobs.empty()) return;
+   if(jobQueue)
+   {
+      // these jobs were already admitted so they bypass any capacity
+      jobQueue->addAll(jobs, true);
+   }
+   else
+   {
+      for(multiJob::List::iterator iter = jobs.begin();iter != jobs.end();++iter)
+      {
+         (*iter)->cancel();
+      }
+   }
+}
@@ -0,0 +1,277 @@
+#include <multiJobTimer.h>
+#include <multiJobQueue.h>
+#include <limits>
+#include <algorithm>
+
+multi::TimerWheel::TimerWheel()
+:m_overflow(FreeListAllocator<Entry>(std::make_shared<FreeList>())),
+ m_slots(LEVELS*SLOTS, m_overflow),
+ m_current(0),
+ m_size(0)
+{
+   for(unsigned int level = 0; level <= LEVELS; ++level)
+   {
+      m_levelSize[level] = 0;
+   }
+}
+
+bool multi::TimerWheel::insert(const Entry& entry)
+{
+   if(entry.m_tick <= m_current) return false;
+   EntryList list(allocator());
+   list.push_back(entry);
+   place(list, list.begin());
+   ++m_size;
+
+   return true;
+}
+
+void multi::TimerWheel::advance(Tick tick, EntryList& due)
+{
+   while(m_current < tick)
+   {
+      // jump over the ticks where nothing happens
+      Tick next = nextEventTick();
+      if(next > tick)
+      {
+         m_current = tick;
+         break;
+      }
+      m_current = next;
+
+      // move entries down when a level wraps.  Lower levels are done first
+      // so the entries coming down from a higher level are not moved twice.
+      for(unsigned int level = 1; level <= LEVELS; ++level)
+      {
+         if((m_current >> (SLOT_BITS*(level-1))) & (SLOTS-1)) break;
+         cascade(level);
+      }
+
+      EntryList& dueSlot = slot(0, m_current);
+      if(!dueSlot.empty())
+      {
+         m_levelSize[0] -= dueSlot.size();
+         m_size         -= dueSlot.size();
+         due.splice(due.end(), dueSlot);
+      }
+   }
+}
+
+multi::TimerWheel::Tick multi::TimerWheel::nextEventTick()const
+{
+   Tick result = std::numeric_limits<Tick>::max();
+   if(m_size == 0) return result;
+
+   // level 0 entries are less than a turn ahead
+   if(m_levelSize[0] > 0)
+   {
+      for(Tick tick = m_current+1; tick < m_current+SLOTS; ++tick)
+      {
+         if(!slot(0, tick).empty())
+         {
+            result = tick;
+            break;
+         }
+      }
+   }
+
+   // a level moves down when the level below it wraps
+   for(unsigned int level = 1; level <= LEVELS; ++level)
+   {
+      if(m_levelSize[level] > 0)
+      {
+         unsigned int shift = SLOT_BITS*level;
+         result = std::min(result, ((m_current >> shift) + 1) << shift);
+      }
+   }
+
+   return result;
+}
+
+void multi::TimerWheel::place(EntryList& list, EntryList::iterator iter)
+{
+   Tick tick  = iter->m_tick;
+   Tick delta = (tick > m_current)?(tick - m_current):0;
+   unsigned int level = 0;
+   while((level < LEVELS)&&(delta >= (Tick(1) << (SLOT_BITS*(level+1)))))
+   {
+      ++level;
+   }
+   EntryList& dest = (level < LEVELS)?slot(level, tick):m_overflow;
+   dest.splice(dest.end(), list, iter);
+   ++m_levelSize[level];
+}
+
+void multi::TimerWheel::cascade(unsigned int level)
+{
+   EntryList entries(allocator());
+   if(level < LEVELS)
+   {
+      entries.swap(slot(level, m_current));
+   }
+   else
+   {
+      entries.swap(m_overflow);
+   }
+   m_levelSize[level] -= entries.size();
+   while(!entries.empty())
+   {
+      place(entries, entries.begin());
+   }
+}
+
+multi::JobTimer::JobTimer()
+:m_start(std::chrono::steady_clock::now()),
+ m_stopFlag(false),
+ m_changedFlag(false)
+{
+}
+
+multi::JobTimer::~JobTimer()
+{
+   stop();
+   waitForCompletion();
+}
+
+std::shared_ptr<multi::JobTimer> multi::JobTimer::instance()
+{
+   static std::shared_ptr<JobTimer> timer;
+   static std::mutex timerMutex;
+   std::lock_guard<std::mutex> lock(timerMutex);
+   if(!timer)
+   {
+      timer = std::make_shared<JobTimer>();
+      timer->start();
+   }
+   return timer;
+}
+
+void multi::JobTimer::schedule(std::shared_ptr<multiJob> job,
+                               std::shared_ptr<multiJobQueue> jobQueue,
+                               std::chrono::steady_clock::time_point when)
+{
+   if(!job||!jobQueue) return;
+   TimerWheel::Entry entry;
+   entry.m_tick     = tickOf(when);
+   entry.m_job      = job;
+   entry.m_jobQueue = jobQueue;
+   bool insertedFlag = false;
+   bool wakeFlag     = false;
+   {
+      std::lock_guard<std::mutex> lock(m_timerMutex);
+      if(m_wheel.size() == 0)
+      {
+         // an idle wheel is not turned so bring it up to date first
+         TimerWheel::EntryList due(m_wheel.allocator());
+         m_wheel.advance(currentTick(), due);
+      }
+      // the thread sleeps until the next event so it only needs waking for
+      // an entry that is due before that
+      TimerWheel::Tick next = m_wheel.nextEventTick();
+      insertedFlag = m_wheel.insert(entry);
+      wakeFlag     = insertedFlag&&(entry.m_tick < next);
+      if(wakeFlag) m_changedFlag = true;
+   }
+   if(!insertedFlag)
+   {
+      jobQueue->add(job);
+   }
+   else if(wakeFlag)
+   {
+      m_condition.notify_one();
+   }
+}
+
+std::size_t multi::JobTimer::size()const
+{
+   std::lock_guard<std::mutex> lock(m_timerMutex);
+   return m_wheel.size();
+}
+
+void multi::JobTimer::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_timerMutex);
+      m_stopFlag = true;
+   }
+   m_condition.notify_all();
+}
+
+void multi::JobTimer::run()
+{
+   std::unique_lock<std::mutex> lock(m_timerMutex);
+   while(!m_stopFlag)
+   {
+      TimerWheel::EntryList due(m_wheel.allocator());
+      m_wheel.advance(currentTick(), due);
+      if(!due.empty())
+      {
+         lock.unlock();
+         deliver(due);
+         lock.lock();
+         continue;
+      }
+
+      m_changedFlag = false;
+      TimerWheel::Tick next = m_wheel.nextEventTick();
+      if(next == std::numeric_limits<TimerWheel::Tick>::max())
+      {
+         m_condition.wait(lock, [this]{return m_stopFlag||m_changedFlag;});
+      }
+      else
+      {
+         m_condition.wait_until(lock,
+                                m_start + std::chrono::milliseconds(next),
+                                [this]{return m_stopFlag||m_changedFlag;});
+      }
+   }
+}
+
+multi::TimerWheel::Tick multi::JobTimer::tickOf(std::chrono::steady_clock::time_point when)const
+{
+   if(when <= m_start) return 0;
+   std::chrono::steady_clock::duration elapsed = when - m_start;
+   TimerWheel::Tick tick = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+   if(std::chrono::milliseconds(tick) < elapsed) ++tick;
+
+   return tick;
+}
+
+multi::TimerWheel::Tick multi::JobTimer::currentTick()const
+{
+   return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void multi::JobTimer::deliver(TimerWheel::EntryList& due)
+{
+   // entries for the same queue are added together
+   while(!due.empty())
+   {
+      std::shared_ptr<multiJobQueue> jobQueue = due.front().m_jobQueue.lock();
+      multiJob::List jobs;
+      TimerWheel::EntryList::iterator iter = due.begin();
+      while(iter != due.end())
+      {
+         if(iter->m_jobQueue.lock() == jobQueue)
+         {
+            if(iter->m_job->isCanceled())
+            {
+               iter->m_job->finished();
+            }
+            else
+            {
+               jobs.push_back(iter->m_job);
+            }
+            iter = due.erase(iter);
+         }
+         else
+         {
+            ++iter;
+         }
+      }
+      if(jobQueue&&!jobs.empty())
+      {
+         jobQueue->addAll(jobs, true);
+      }
+   }
+}
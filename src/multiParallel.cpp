@@ -0,0 +1,78 @@
+#include <multiParallel.h>
+
+multi::ParallelLoop::ParallelLoop(std::size_t total, std::size_t grain, std::size_t participants)
+:m_total(total),
+ m_grain((grain > 0)?grain:1),
+ m_participants((participants > 0)?participants:1),
+ m_next(0),
+ m_active(0)
+{
+}
+
+bool multi::ParallelLoop::nextChunk(std::size_t& first, std::size_t& last)
+{
+   std::size_t current = m_next.load(std::memory_order_relaxed);
+   std::size_t size = 0;
+   do
+   {
+      if(current >= m_total) return false;
+      std::size_t remaining = m_total - current;
+      size = std::max(m_grain, remaining/(2*m_participants));
+      size = std::min(size, remaining);
+   } while(!m_next.compare_exchange_weak(current, current+size,
+                                         std::memory_order_relaxed,
+                                         std::memory_order_relaxed));
+   first = current;
+   last  = current+size;
+
+   return true;
+}
+
+bool multi::ParallelLoop::enter()
+{
+   if(m_active.fetch_add(1, std::memory_order_acq_rel) & CLOSED)
+   {
+      leave();
+      return false;
+   }
+   return true;
+}
+
+void multi::ParallelLoop::leave()
+{
+   if(m_active.fetch_sub(1, std::memory_order_acq_rel) == (CLOSED|1))
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_condition.notify_all();
+   }
+}
+
+void multi::ParallelLoop::closeAndWait()
+{
+   if(m_active.fetch_or(CLOSED, std::memory_order_acq_rel) == 0) return;
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_condition.wait(lock, [this]{return m_active.load(std::memory_order_acquire) == CLOSED;});
+}
+
+void multi::ParallelLoop::setException(std::exception_ptr exception)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_exception) m_exception = exception;
+   }
+   // no more chunks are handed out
+   m_next.store(m_total, std::memory_order_relaxed);
+}
+
+void multi::ParallelLoop::rethrowIfFailed()const
+{
+   // called after closeAndWait so no helper can still write m_exception
+   if(m_exception) std::rethrow_exception(m_exception);
+}
+
+std::size_t multi::ParallelLoop::helpersNeeded(std::size_t available)const
+{
+   std::size_t chunks = (m_total + m_grain - 1)/m_grain;
+   if(chunks < 2) return 0;
+   return std::min(available, chunks-1);
+}
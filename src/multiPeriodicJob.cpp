@@ -0,0 +1,96 @@
+#include <multiPeriodicJob.h>
+#include <multiJobQueue.h>
+#include <multiJobTimer.h>
+
+multiPeriodicJob::multiPeriodicJob(Clock::duration period,
+                                   Mode mode,
+                                   MissedPolicy missedPolicy)
+:m_period((period > Clock::duration::zero())?period:Clock::duration(1)),
+ m_mode(mode),
+ m_missedPolicy(missedPolicy),
+ m_stopFlag(false),
+ m_runCount(0),
+ m_missedCount(0)
+{
+}
+
+void multiPeriodicJob::start()
+{
+   if(!isStopped())
+   {
+      multiJob::start();
+      m_runCount.fetch_add(1, std::memory_order_relaxed);
+   }
+   if(isStopped())
+   {
+      // the job was re-added before the cancel could reach it
+      multiJob::cancel();
+      finished();
+      return;
+   }
+   reschedule();
+}
+
+void multiPeriodicJob::cancel()
+{
+   m_stopFlag.store(true, std::memory_order_release);
+   multiJob::cancel();
+}
+
+void multiPeriodicJob::schedule(std::shared_ptr<multiJobQueue> jobQueue, Clock::time_point first)
+{
+   if(!jobQueue) return;
+   m_periodicQueue = jobQueue;
+   m_nextTime      = first;
+   multi::JobTimer::instance()->schedule(getSharedFromThis(), jobQueue, first);
+}
+
+void multiPeriodicJob::reschedule()
+{
+   std::shared_ptr<multiJobQueue> jobQueue = m_periodicQueue.lock();
+   if(!jobQueue) return;
+
+   Clock::time_point now = Clock::now();
+   if(m_mode == FIXED_DELAY)
+   {
+      m_nextTime = now + m_period;
+   }
+   else
+   {
+      m_nextTime += m_period;
+      if(m_nextTime <= now)
+      {
+         // number of due times that have passed, counting this one
+         Clock::duration::rep behind = (now - m_nextTime)/m_period + 1;
+         switch(m_missedPolicy)
+         {
+            case SKIP_MISSED:
+            {
+               m_nextTime += m_period*behind;
+               m_missedCount.fetch_add(behind, std::memory_order_relaxed);
+               break;
+            }
+            case RUN_ONCE:
+            {
+               m_nextTime += m_period*(behind-1);
+               m_missedCount.fetch_add(behind-1, std::memory_order_relaxed);
+               break;
+            }
+            case RUN_ALL:
+            {
+               break;
+            }
+         }
+      }
+   }
+
+   if(m_nextTime <= now)
+   {
+      // a worker must not block on a full queue to put back its own job
+      jobQueue->addAll(multiJob::List(1, getSharedFromThis()), true);
+   }
+   else
+   {
+      multi::JobTimer::instance()->schedule(getSharedFromThis(), jobQueue, m_nextTime);
+   }
+}
@@ -0,0 +1,146 @@
+#include "testSupport.h"
+#include <multiJobQueue.h>
+#include <multiJobRingQueue.h>
+#include <multiJobThreadQueue.h>
+#include <multiJobPool.h>
+#include <multiFreeList.h>
+#include <cstdlib>
+#include <new>
+
+namespace{
+   /**
+   * Heap allocations made by the calling thread
+   */
+   thread_local long t_allocationCount = 0;
+
+   /**
+   * Lets the test look at the spare list nodes
+   */
+   class SpareNodeQueue : public multiJobQueue
+   {
+   public:
+      std::size_t spareNodeCount()const{return m_spareNodes.size();}
+   };
+
+   // user-014 a steady stream of pooled jobs does not touch the heap
+   void testSteadyStateAllocations()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      multi::JobPool<test::CountJob> pool;
+      std::atomic<int> counter(0);
+      long allocations = 0;
+      for(int round = 0;round < 3;++round)
+      {
+         long before = t_allocationCount;
+         for(int idx = 0;idx < 100;++idx) q->add(pool.create(&counter));
+         std::shared_ptr<multiJob> job;
+         while((job = q->nextJob(false))) job->start();
+         allocations = t_allocationCount - before;
+      }
+      TEST_CHECK(counter == 300);
+      TEST_CHECK(allocations == 0);
+   }
+
+   // user-014 work stealing deque boxes are recycled by take and steal
+   void testDequeAllocations()
+   {
+      multi::WorkStealingDeque deque;
+      multi::JobPool<test::CountJob> pool;
+      std::atomic<int> counter(0);
+      long allocations = 0;
+      for(int round = 0;round < 3;++round)
+      {
+         long before = t_allocationCount;
+         for(int idx = 0;idx < 100;++idx) deque.push(pool.create(&counter));
+         for(int idx = 0;idx < 50;++idx) deque.take()->start();
+         std::shared_ptr<multiJob> job;
+         while((job = deque.steal())) job->start();
+         allocations = t_allocationCount - before;
+      }
+      TEST_CHECK(counter == 300);
+      TEST_CHECK(allocations == 0);
+   }
+
+   // user-014 batch claims reuse the nodes a consumer gives back
+   void testBatchAllocations()
+   {
+      std::shared_ptr<multiJobQueue> queues[] = {
+         std::make_shared<multiJobQueue>(),
+         std::make_shared<multiJobRingQueue>(128)
+      };
+      for(int queueIdx = 0;queueIdx < 2;++queueIdx)
+      {
+         std::shared_ptr<multiJobQueue> q = queues[queueIdx];
+         multi::JobPool<test::CountJob> pool;
+         std::atomic<int> counter(0);
+         long allocations = 0;
+         multiJob::List batch;
+         multiJob::List spent;
+         for(int round = 0;round < 3;++round)
+         {
+            long before = t_allocationCount;
+            for(int idx = 0;idx < 100;++idx) q->add(pool.create(&counter));
+            while(q->nextJobs(8, batch, false))
+            {
+               while(!batch.empty())
+               {
+                  std::shared_ptr<multiJob> job;
+                  job.swap(batch.front());
+                  spent.splice(spent.end(), batch, batch.begin());
+                  job->start();
+               }
+               q->recycleNodes(spent);
+            }
+            allocations = t_allocationCount - before;
+         }
+         TEST_CHECK(counter == 300);
+         TEST_CHECK(allocations == 0);
+      }
+   }
+
+   // user-014 the caches give memory back past their limit
+   void testCacheLimits()
+   {
+      multi::FreeList freeList(4);
+      std::vector<void*> blocks;
+      for(int idx = 0;idx < 10;++idx) blocks.push_back(freeList.allocate(32));
+      for(std::size_t idx = 0;idx < blocks.size();++idx) freeList.deallocate(blocks[idx], 32);
+      TEST_CHECK(freeList.freeCount() == 4);
+      freeList.setMaxFree(2);
+      TEST_CHECK(freeList.freeCount() == 2);
+
+      multi::JobPool<test::CountJob> pool;
+      pool.reserve(2000);
+      TEST_CHECK(pool.freeCount() >= 2000);
+
+      std::shared_ptr<SpareNodeQueue> q = std::make_shared<SpareNodeQueue>();
+      for(int idx = 0;idx < 3000;++idx) q->add(std::make_shared<test::CountJob>());
+      while(q->nextJob(false)){}
+      TEST_CHECK(q->spareNodeCount() == 1024);
+      q->setCapacity(2048);
+      for(int idx = 0;idx < 2048;++idx) q->add(std::make_shared<test::CountJob>());
+      while(q->nextJob(false)){}
+      TEST_CHECK(q->spareNodeCount() == 2048);
+   }
+}
+
+void* operator new(std::size_t size)
+{
+   ++t_allocationCount;
+   void* result = std::malloc(size?size:1);
+   if(!result) throw std::bad_alloc();
+   return result;
+}
+
+void operator delete(void* ptr) noexcept
+{
+   std::free(ptr);
+}
+
+void test::runAllocationTests()
+{
+   testSteadyStateAllocations();
+   testDequeAllocations();
+   testBatchAllocations();
+   testCacheLimits();
+}
@@ -0,0 +1,222 @@
+#include "testSupport.h"
+#include <multiJobQueue.h>
+#include <multiJobMultiThreadQueue.h>
+#include <multiJobGraph.h>
+#include <multiParallel.h>
+#include <multiForkJoin.h>
+#include <multiJobRingQueue.h>
+#include <stdexcept>
+
+namespace{
+   /**
+   * Sums [first, last) by splitting it in halves with fork and join
+   */
+   class SumJob : public multiJob
+   {
+   public:
+      SumJob(long long first, long long last):m_first(first), m_last(last), m_sum(0){}
+
+      long long m_first;
+      long long m_last;
+      long long m_sum;
+
+   protected:
+      virtual void run()
+      {
+         if((m_last - m_first) <= 64)
+         {
+            for(long long idx = m_first;idx < m_last;++idx) m_sum += idx;
+            return;
+         }
+         long long middle = m_first + (m_last - m_first)/2;
+         std::shared_ptr<SumJob> left  = std::make_shared<SumJob>(m_first, middle);
+         std::shared_ptr<SumJob> right = std::make_shared<SumJob>(middle, m_last);
+         multi::ForkJoin forkJoin;
+         forkJoin.fork(left);
+         forkJoin.fork(right);
+         forkJoin.join();
+         m_sum = left->m_sum + right->m_sum;
+      }
+   };
+
+   // user-015 and user-016 callables return typed results and exceptions
+   void testSubmit()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      multi::JobResult<int> value = q->submit([]{return 42;});
+      TEST_CHECK(value.get() == 42);
+
+      multi::JobResult<int> next = value.then([](multi::JobResult<int> r){return r.get()+1;});
+      TEST_CHECK(next.get() == 43);
+
+      multi::JobResult<void> failed = q->submit([]{throw std::runtime_error("failed");});
+      bool thrown = false;
+      try{failed.get();}catch(const std::runtime_error&){thrown = true;}
+      TEST_CHECK(thrown);
+      pool->cancel();
+      pool->waitForCompletion();
+
+      // a result whose job is dropped unrun reports JobNotRun
+      std::shared_ptr<multiJobQueue> idle = std::make_shared<multiJobQueue>();
+      multi::JobResult<int> dropped = idle->submit([]{return 1;});
+      idle->clear();
+      thrown = false;
+      try{dropped.get();}catch(const multi::JobNotRun&){thrown = true;}
+      TEST_CHECK(thrown);
+   }
+
+   // user-017 nodes start after their predecessors, cycles are rejected
+   void testGraph()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 3);
+      std::vector<int> order;
+      std::mutex orderMutex;
+      std::shared_ptr<multiJobGraph> graph = std::make_shared<multiJobGraph>();
+      multiJobGraph::Node a = graph->add(std::make_shared<test::CountJob>((std::atomic<int>*)0, &order, 1, &orderMutex));
+      multiJobGraph::Node b = graph->add(std::make_shared<test::CountJob>((std::atomic<int>*)0, &order, 2, &orderMutex));
+      multiJobGraph::Node c = graph->add(std::make_shared<test::CountJob>((std::atomic<int>*)0, &order, 2, &orderMutex));
+      multiJobGraph::Node d = graph->add(std::make_shared<test::CountJob>((std::atomic<int>*)0, &order, 3, &orderMutex));
+      TEST_CHECK(graph->addEdge(a, b));
+      TEST_CHECK(graph->addEdge(a, c));
+      TEST_CHECK(graph->addEdge(b, d));
+      TEST_CHECK(graph->addEdge(c, d));
+      TEST_CHECK(!graph->addEdge(a, 99));
+      TEST_CHECK(graph->run(q));
+      TEST_CHECK(graph->waitFor(5000));
+      TEST_CHECK(order.size() == 4);
+      TEST_CHECK((order.size() == 4)&&(order[0] == 1)&&(order[1] == 2)&&(order[2] == 2)&&(order[3] == 3));
+      TEST_CHECK(!graph->run(q));
+      TEST_CHECK(graph->add(std::make_shared<test::CountJob>()) == multiJobGraph::INVALID_NODE);
+      TEST_CHECK(graph->addFunction([]{}) == multiJobGraph::INVALID_NODE);
+      TEST_CHECK(!graph->addEdge(a, d));
+      TEST_CHECK(graph->size() == 4);
+
+      std::shared_ptr<multiJobGraph> cycle = std::make_shared<multiJobGraph>();
+      multiJobGraph::Node x = cycle->addFunction([]{});
+      multiJobGraph::Node y = cycle->addFunction([]{});
+      cycle->addEdge(x, y);
+      cycle->addEdge(y, x);
+      TEST_CHECK(!cycle->run(q));
+
+      // a failing node cancels the rest and reports its exception
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJobGraph> failing = std::make_shared<multiJobGraph>();
+      multiJobGraph::Node f = failing->addFunction([]{throw std::runtime_error("failed");});
+      multiJobGraph::Node g = failing->add(std::make_shared<test::CountJob>(&counter));
+      failing->addEdge(f, g);
+      failing->run(q);
+      failing->wait();
+      TEST_CHECK(failing->exception() != nullptr);
+      TEST_CHECK(failing->isCanceled());
+      TEST_CHECK(counter == 0);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-019 every index is visited once
+   void testParallel()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 3);
+      std::vector<std::atomic<int> > visits(1000);
+      for(std::size_t idx = 0;idx < visits.size();++idx) visits[idx] = 0;
+      multi::parallelFor(pool, 0, 1000, 16, [&visits](int idx){++visits[idx];});
+      bool once = true;
+      for(std::size_t idx = 0;idx < visits.size();++idx) once = once&&(visits[idx] == 1);
+      TEST_CHECK(once);
+
+      long long sum = multi::parallelReduce(pool, 0LL, 10000LL, 100LL, 0LL,
+                                            [](long long idx){return idx;},
+                                            [](long long a, long long b){return a+b;});
+      TEST_CHECK(sum == 49995000LL);
+
+      bool thrown = false;
+      try
+      {
+         multi::parallelFor(pool, 0, 100, 1, [](int idx){if(idx == 50) throw std::runtime_error("failed");});
+      }
+      catch(const std::runtime_error&)
+      {
+         thrown = true;
+      }
+      TEST_CHECK(thrown);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-020 recursive fork and join on a small pool does not deadlock
+   void testForkJoin()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      std::shared_ptr<SumJob> job = std::make_shared<SumJob>(0, 100000);
+      std::shared_ptr<multi::JobGroup> group = std::make_shared<multi::JobGroup>();
+      job->setGroup(group);
+      q->add(job);
+      TEST_CHECK(group->waitFor(10000));
+      TEST_CHECK(job->m_sum == 4999950000LL);
+
+      // outside a job thread the caller helps
+      std::shared_ptr<SumJob> direct = std::make_shared<SumJob>(0, 1000);
+      {
+         multi::ForkJoin forkJoin(q);
+         forkJoin.fork(direct);
+         forkJoin.join();
+      }
+      TEST_CHECK(direct->m_sum == 499500);
+
+      bool thrown = false;
+      try
+      {
+         multi::ForkJoin forkJoin(q);
+         forkJoin.forkFunction([]{throw std::runtime_error("failed");});
+         forkJoin.join();
+      }
+      catch(const std::runtime_error&)
+      {
+         thrown = true;
+      }
+      TEST_CHECK(thrown);
+      pool->cancel();
+      pool->waitForCompletion();
+
+      // canceled and expired children end the join with JobNotRun
+      std::shared_ptr<multiJobQueue> queues[] = {
+         std::make_shared<multiJobQueue>(),
+         std::make_shared<multiJobRingQueue>(4)
+      };
+      for(int idx = 0;idx < 2;++idx)
+      {
+         std::atomic<int> counter(0);
+         std::shared_ptr<multiJob> canceled = std::make_shared<test::CountJob>(&counter);
+         std::shared_ptr<multiJob> expired  = std::make_shared<test::CountJob>(&counter);
+         expired->setDeadline(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+         thrown = false;
+         try
+         {
+            multi::ForkJoin forkJoin(queues[idx]);
+            forkJoin.fork(canceled);
+            forkJoin.fork(expired);
+            forkJoin.fork(std::make_shared<test::CountJob>(&counter));
+            canceled->cancel();
+            forkJoin.join();
+         }
+         catch(const multi::JobNotRun&)
+         {
+            thrown = true;
+         }
+         TEST_CHECK(thrown);
+         TEST_CHECK(counter == 1);
+      }
+   }
+}
+
+void test::runComposeTests()
+{
+   testSubmit();
+   testGraph();
+   testParallel();
+   testForkJoin();
+}
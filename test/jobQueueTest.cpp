@@ -0,0 +1,503 @@
+#include "testSupport.h"
+#include <multiJobQueue.h>
+#include <multiJobRingQueue.h>
+#include <multiJobMultiThreadQueue.h>
+#include <thread>
+
+namespace{
+   std::shared_ptr<multiJob> makeJob(int tag, double priority=0.0)
+   {
+      std::shared_ptr<multiJob> job = std::make_shared<test::CountJob>();
+      job->setId(std::to_string(tag));
+      job->setPriority(priority);
+      return job;
+   }
+
+   int tagOf(const std::shared_ptr<multiJob>& job)
+   {
+      return job?std::stoi(job->id()):-1;
+   }
+
+   class BatchCallback : public multiJobQueue::Callback
+   {
+   public:
+      BatchCallback():m_batches(0), m_added(0){}
+      virtual void addingBatch(std::shared_ptr<multiJobQueue>, const multiJob::List&){++m_batches;}
+      virtual void addedBatch(std::shared_ptr<multiJobQueue>, const multiJob::List& jobs){m_added += int(jobs.size());}
+
+      int m_batches;
+      int m_added;
+   };
+
+   // user-001 higher priorities are dispatched first, equal ones in FIFO order
+   void testPriorityOrdering()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::PRIORITY_ORDERING);
+      q->add(makeJob(1, 1.0));
+      q->add(makeJob(2, 3.0));
+      q->add(makeJob(3, 2.0));
+      q->add(makeJob(4, 3.0));
+      std::shared_ptr<multiJob> last = makeJob(5, 0.0);
+      q->add(last);
+      last->setPriority(10.0);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 5);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 4);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 3);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(!q->nextJob(false));
+
+      // switching back to FIFO restores the arrival order
+      q->add(makeJob(1, 1.0));
+      multi::Thread::sleepInMilliSeconds(30);
+      q->add(makeJob(2, 2.0));
+      q->setOrderingMode(multiJobQueue::FIFO_ORDERING);
+      TEST_CHECK(q->oldestJobWaitMillis() >= 25);
+      q->add(makeJob(3, 3.0));
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 3);
+   }
+
+   // user-003 lookups by id, name and pointer
+   void testLookups()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJob> first  = makeJob(1);
+      std::shared_ptr<multiJob> second = makeJob(2);
+      std::shared_ptr<multiJob> third  = makeJob(3);
+      first->setName("first");
+      q->add(first);
+      q->add(second);
+      q->add(third);
+      q->add(third);
+      TEST_CHECK(q->size() == 3);
+
+      TEST_CHECK(q->removeByName("first") == first);
+      TEST_CHECK(!q->removeByName("first"));
+      TEST_CHECK(q->removeById("2") == second);
+      second->setName("second");
+      third->setName("renamed");
+      TEST_CHECK(q->removeByName("renamed") == third);
+      TEST_CHECK(q->isEmpty());
+
+      q->add(first);
+      TEST_CHECK(q->claim(first));
+      TEST_CHECK(!q->claim(first));
+      q->add(first);
+      q->remove(first);
+      TEST_CHECK(q->isEmpty());
+   }
+
+   // user-003 the unique flag and the earliest of several matches
+   void testDuplicates()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::PRIORITY_ORDERING);
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJob> twice = std::make_shared<test::CountJob>(&counter);
+      q->add(twice);
+      q->add(twice);
+      TEST_CHECK(q->size() == 1);
+      q->add(twice, false);
+      TEST_CHECK(q->size() == 2);
+      twice->setName("twice");
+      TEST_CHECK(q->removeByName("twice") == twice);
+      TEST_CHECK(twice->jobQueue() == q);
+      TEST_CHECK(q->removeByName("twice") == twice);
+      TEST_CHECK(!twice->jobQueue());
+      TEST_CHECK(q->isEmpty());
+
+      q->add(twice);
+      q->add(twice, false);
+      std::shared_ptr<multiJob> job;
+      while((job = q->nextJob(false))) job->start();
+      TEST_CHECK(counter == 2);
+
+      // the keys are hashed so the earliest queued job has to be picked
+      for(int idx = 0;idx < 16;++idx)
+      {
+         std::shared_ptr<multiJob> dup = makeJob(idx, double(idx%4));
+         dup->setName("dup");
+         q->add(dup);
+         std::shared_ptr<multiJob> sameId = makeJob(100, double(idx%3));
+         sameId->setName(std::to_string(idx));
+         q->add(sameId);
+      }
+      bool ordered = true;
+      for(int idx = 0;idx < 16;++idx)
+      {
+         ordered = ordered&&(tagOf(q->removeByName("dup")) == idx);
+         ordered = ordered&&(q->removeById("100")->name() == std::to_string(idx));
+      }
+      TEST_CHECK(ordered);
+      TEST_CHECK(q->isEmpty());
+
+      // a name or id set while the job waits is indexed in any order
+      std::shared_ptr<multiJob> late = std::make_shared<test::CountJob>();
+      q->add(late);
+      late->setName("late");
+      TEST_CHECK(q->removeByName("late") == late);
+      q->add(late);
+      late->setId("lateId");
+      TEST_CHECK(q->removeById("lateId") == late);
+      TEST_CHECK(q->isEmpty());
+   }
+
+   // user-001 queued jobs point back at the queue
+   void testJobLink()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJob> plain = std::make_shared<test::CountJob>();
+      std::shared_ptr<multiJob> named = makeJob(1);
+      TEST_CHECK(!plain->hasKeys()&&named->hasKeys());
+      q->add(plain);
+      q->add(named);
+      TEST_CHECK(plain->jobQueue() == q);
+      TEST_CHECK(named->jobQueue() == q);
+
+      plain->setPriority(1.0);
+      q->setOrderingMode(multiJobQueue::PRIORITY_ORDERING);
+      named->setPriority(2.0);
+      TEST_CHECK(q->nextJob(false) == named);
+      TEST_CHECK(!named->jobQueue());
+      TEST_CHECK(q->nextJob(false) == plain);
+      TEST_CHECK(!plain->jobQueue());
+
+      // a queue not owned by a shared_ptr still queues
+      multiJobQueue local(multiJobQueue::PRIORITY_ORDERING);
+      local.add(plain);
+      local.add(named);
+      TEST_CHECK(local.size() == 2);
+      TEST_CHECK(!plain->jobQueue());
+      TEST_CHECK(local.nextJob(false) == named);
+      TEST_CHECK(local.nextJob(false) == plain);
+   }
+
+   // user-004 one batch, duplicates dropped
+   void testAddAll()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<BatchCallback> callback = std::make_shared<BatchCallback>();
+      q->setCallback(callback);
+      std::vector<std::shared_ptr<multiJob> > jobs;
+      for(int idx = 0;idx < 5;++idx) jobs.push_back(makeJob(idx));
+      jobs.push_back(jobs.front());
+      q->add(jobs.begin(), jobs.end());
+      TEST_CHECK(callback->m_batches == 1);
+      TEST_CHECK(callback->m_added == 5);
+      TEST_CHECK(q->size() == 5);
+      for(int idx = 0;idx < 5;++idx) TEST_CHECK(tagOf(q->nextJob(false)) == idx);
+   }
+
+   // user-005 several jobs per call, in queue order
+   void testNextJobs()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      for(int idx = 0;idx < 5;++idx) q->add(makeJob(idx));
+      multiJob::List jobs;
+      TEST_CHECK(q->nextJobs(3, jobs, false) == 3);
+      TEST_CHECK(jobs.size() == 3);
+      TEST_CHECK(tagOf(jobs.front()) == 0);
+      TEST_CHECK(tagOf(jobs.back()) == 2);
+      TEST_CHECK(q->nextJobs(3, jobs, false) == 2);
+      TEST_CHECK(q->nextJobs(3, jobs, false) == 0);
+
+      // canceled jobs are finished and skipped
+      std::shared_ptr<multiJob> canceled = makeJob(7);
+      q->add(canceled);
+      q->add(makeJob(8));
+      canceled->cancel();
+      jobs.clear();
+      TEST_CHECK(q->nextJobs(2, jobs, false) == 1);
+      TEST_CHECK(tagOf(jobs.front()) == 8);
+      TEST_CHECK(canceled->isFinished());
+   }
+
+   // user-006 capacity and backpressure
+   void testCapacity()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      q->setCapacity(2);
+      TEST_CHECK(q->capacity() == 2);
+      TEST_CHECK(q->tryAdd(makeJob(1)));
+      TEST_CHECK(q->tryAdd(makeJob(2)));
+      TEST_CHECK(!q->tryAdd(makeJob(3)));
+      TEST_CHECK(!q->addFor(makeJob(3), 10));
+
+      std::shared_ptr<multiJob> blocked = makeJob(3);
+      std::thread producer([q, blocked]{q->add(blocked);});
+      multi::Thread::sleepInMilliSeconds(10);
+      TEST_CHECK(q->size() == 2);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      producer.join();
+      TEST_CHECK(q->size() == 2);
+
+      // ignoreCapacity goes over the limit
+      q->addAll(multiJob::List(1, makeJob(4)), true);
+      TEST_CHECK(q->size() == 3);
+   }
+
+   // user-006 releaseBlock and clear end a wait for space without adding
+   void testReleaseSpaceWait()
+   {
+      std::shared_ptr<multiJobQueue> queues[] = {
+         std::make_shared<multiJobQueue>(),
+         std::make_shared<multiJobRingQueue>(2)
+      };
+      queues[0]->setCapacity(2);
+      for(int idx = 0;idx < 2;++idx)
+      {
+         std::shared_ptr<multiJobQueue> q = queues[idx];
+         TEST_CHECK(q->tryAdd(makeJob(1)));
+         TEST_CHECK(q->tryAdd(makeJob(2)));
+
+         // releaseBlock is for consumers, the producer keeps waiting
+         std::atomic<bool> done(false);
+         bool added = false;
+         std::thread blocked([q, &done, &added]{
+            added = q->add(makeJob(3));
+            done = true;
+         });
+         for(int count = 0;count < 10;++count)
+         {
+            q->releaseBlock();
+            multi::Thread::sleepInMilliSeconds(2);
+         }
+         TEST_CHECK(!done);
+         TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+         blocked.join();
+         TEST_CHECK(added);
+         TEST_CHECK(q->size() == 2);
+
+         done = false;
+         added = true;
+         std::thread producer([q, &done, &added]{
+            added = q->addFor(makeJob(4), 10000);
+            done = true;
+         });
+         TEST_CHECK(test::waitUntil([q, &done]{
+            q->releaseProducers();
+            return done.load();
+         }));
+         producer.join();
+         TEST_CHECK(!added);
+         TEST_CHECK(q->size() == 2);
+
+         done = false;
+         added = true;
+         std::thread released([q, &done, &added]{
+            added = q->add(makeJob(4));
+            done = true;
+         });
+         TEST_CHECK(test::waitUntil([q, &done]{
+            q->releaseProducers();
+            return done.load();
+         }));
+         released.join();
+         TEST_CHECK(!added);
+         TEST_CHECK(q->size() == 2);
+
+         added = true;
+         std::thread cleared([q, &added]{added = q->addFor(makeJob(3), 10000);});
+         multi::Thread::sleepInMilliSeconds(10);
+         q->clear();
+         cleared.join();
+         TEST_CHECK(!added);
+         TEST_CHECK(q->isEmpty());
+      }
+
+      // stopping workers does not drop the job of a blocked producer
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      q->setCapacity(1);
+      std::atomic<bool> open(false);
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      for(int idx = 0;idx < 2;++idx)
+      {
+         q->add(std::make_shared<multiFunctionJob>([&open, &counter]{
+            while(!open.load()) multi::Thread::sleepInMilliSeconds(1);
+            ++counter;
+         }));
+      }
+      q->add(std::make_shared<test::CountJob>(&counter));
+      std::thread producer([q, &counter]{q->add(std::make_shared<test::CountJob>(&counter));});
+      std::thread opener([&open]{
+         multi::Thread::sleepInMilliSeconds(30);
+         open = true;
+      });
+      multi::Thread::sleepInMilliSeconds(10);
+      pool->setNumberOfThreads(1);
+      opener.join();
+      producer.join();
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 4;}));
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-010 the oldest wait follows arrival, not dispatch order
+   void testOldestWait()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::DEADLINE_ORDERING);
+      TEST_CHECK(q->oldestJobWaitMillis() == 0);
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      std::shared_ptr<multiJob> first = makeJob(1);
+      first->setDeadline(now + std::chrono::hours(2));
+      q->add(first);
+      multi::Thread::sleepInMilliSeconds(30);
+      for(int idx = 2;idx < 6;++idx)
+      {
+         std::shared_ptr<multiJob> job = makeJob(idx);
+         job->setDeadline(now + std::chrono::minutes(idx));
+         q->add(job);
+      }
+      TEST_CHECK(q->oldestJobWaitMillis() >= 25);
+      q->nextJob(false);
+      TEST_CHECK(q->oldestJobWaitMillis() >= 25);
+      q->remove(first);
+      TEST_CHECK(q->oldestJobWaitMillis() < 25);
+      q->clear();
+      TEST_CHECK(q->oldestJobWaitMillis() == 0);
+   }
+
+   // user-008 a blocked consumer wakes for an add and for releaseBlock
+   void testBlockingNextJob()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJob> result;
+      std::thread consumer([q, &result]{result = q->nextJob(true);});
+      multi::Thread::sleepInMilliSeconds(10);
+      q->add(makeJob(1));
+      consumer.join();
+      TEST_CHECK(tagOf(result) == 1);
+
+      std::thread released([q, &result]{result = q->nextJob(true);});
+      multi::Thread::sleepInMilliSeconds(10);
+      q->releaseBlock();
+      released.join();
+      TEST_CHECK(!result);
+   }
+
+   // user-023 earliest deadline first, expired jobs are dropped and counted
+   void testDeadlineOrdering()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::DEADLINE_ORDERING);
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      std::shared_ptr<multiJob> late    = makeJob(1);
+      std::shared_ptr<multiJob> early   = makeJob(2);
+      std::shared_ptr<multiJob> none    = makeJob(3);
+      std::shared_ptr<multiJob> expired = makeJob(4);
+      late->setDeadline(now + std::chrono::seconds(20));
+      early->setDeadline(now + std::chrono::seconds(10));
+      expired->setDeadline(now - std::chrono::seconds(1));
+      q->add(none);
+      q->add(late);
+      q->add(early);
+      q->add(expired);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(q->deadlineMissCount() == 1);
+      TEST_CHECK(expired->isCanceled()&&expired->isFinished());
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 3);
+   }
+
+   // user-024 tenants share the dispatches by weight
+   void testFairShare()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::FAIR_SHARE_ORDERING);
+      q->setTenantWeight("a", 2);
+      for(int idx = 0;idx < 6;++idx)
+      {
+         std::shared_ptr<multiJob> job = makeJob(idx);
+         job->setTenant("a");
+         q->add(job);
+      }
+      for(int idx = 10;idx < 13;++idx)
+      {
+         std::shared_ptr<multiJob> job = makeJob(idx);
+         job->setTenant("b");
+         q->add(job);
+      }
+      TEST_CHECK(q->tenantStats("a").depth == 6);
+      TEST_CHECK(q->tenantStats("b").depth == 3);
+      int tenantA = 0;
+      for(int idx = 0;idx < 6;++idx)
+      {
+         if(tagOf(q->nextJob(false)) < 10) ++tenantA;
+      }
+      TEST_CHECK(tenantA == 4);
+      TEST_CHECK(q->tenantStats("a").dispatched == 4);
+      TEST_CHECK(q->tenantStats("b").dispatched == 2);
+      TEST_CHECK(q->tenantStats("unknown").depth == 0);
+   }
+
+   // user-025 an old low priority job overtakes newer high priority ones
+   void testPriorityAging()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>(multiJobQueue::PRIORITY_ORDERING);
+      q->setPriorityAging(1000.0);
+      TEST_CHECK(q->priorityAging() == 1000.0);
+      q->add(makeJob(1, 0.0));
+      multi::Thread::sleepInMilliSeconds(30);
+      q->add(makeJob(2, 5.0));
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(!q->maxWaitMillisByPriority().empty());
+      q->resetMaxWait();
+      TEST_CHECK(q->maxWaitMillisByPriority().empty());
+
+      q->setPriorityAging(0.0);
+      q->add(makeJob(1, 0.0));
+      multi::Thread::sleepInMilliSeconds(5);
+      q->add(makeJob(2, 5.0));
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+
+      // changing the rate rekeys the jobs already queued
+      q->add(makeJob(1, 0.0));
+      multi::Thread::sleepInMilliSeconds(30);
+      q->add(makeJob(2, 5.0));
+      q->setPriorityAging(1000.0);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+
+      // a rebanded job goes behind older jobs of its band, not to the end
+      q->setPriorityAging(0.0);
+      std::shared_ptr<multiJob> moved = makeJob(1, 1.0);
+      q->add(moved);
+      q->add(makeJob(2, 0.0));
+      q->add(makeJob(3, 0.0));
+      moved->setPriority(0.0);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 1);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 2);
+      TEST_CHECK(tagOf(q->nextJob(false)) == 3);
+
+      // waits are kept per configured band, not per priority
+      std::vector<double> bands;
+      bands.push_back(10.0);
+      bands.push_back(0.0);
+      q->setWaitStatsBands(bands);
+      TEST_CHECK((q->waitStatsBands().size() == 2)&&(q->waitStatsBands()[0] == 0.0));
+      for(int idx = -5;idx < 20;++idx) q->add(makeJob(idx, double(idx)));
+      while(q->nextJob(false)){}
+      std::map<double, unsigned long long> waits = q->maxWaitMillisByPriority();
+      TEST_CHECK(waits.size() == 2);
+      TEST_CHECK((waits.count(0.0) == 1)&&(waits.count(10.0) == 1));
+   }
+}
+
+void test::runJobQueueTests()
+{
+   testPriorityOrdering();
+   testLookups();
+   testJobLink();
+   testDuplicates();
+   testAddAll();
+   testNextJobs();
+   testCapacity();
+   testReleaseSpaceWait();
+   testOldestWait();
+   testBlockingNextJob();
+   testDeadlineOrdering();
+   testFairShare();
+   testPriorityAging();
+}
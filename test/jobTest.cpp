@@ -0,0 +1,183 @@
+#include "testSupport.h"
+#include <multiJob.h>
+#include <multiJobPool.h>
+#include <multiJobGroup.h>
+#include <stdexcept>
+#include <string>
+
+namespace{
+   class RecordingCallback : public multiJobCallback
+   {
+   public:
+      RecordingCallback():m_ready(0), m_started(0), m_finished(0), m_canceled(0){}
+      virtual void ready(std::shared_ptr<multiJob>)   {++m_ready;}
+      virtual void started(std::shared_ptr<multiJob>) {++m_started;}
+      virtual void finished(std::shared_ptr<multiJob>){++m_finished;}
+      virtual void canceled(std::shared_ptr<multiJob>){++m_canceled;}
+
+      int m_ready;
+      int m_started;
+      int m_finished;
+      int m_canceled;
+   };
+
+   class ThrowJob : public multiJob
+   {
+   protected:
+      virtual void run(){throw std::runtime_error("failed");}
+   };
+
+   class InterruptJob : public multiJob
+   {
+   protected:
+      virtual void run(){throw multi::Thread::Interrupt("canceled");}
+   };
+
+   // user-012 state transitions keep the cancel flag and clear the others
+   void testStateTransitions()
+   {
+      std::shared_ptr<test::CountJob> job = std::make_shared<test::CountJob>();
+      TEST_CHECK(job->isReady());
+      job->running();
+      TEST_CHECK(job->isRunning()&&!job->isReady());
+      job->cancel();
+      TEST_CHECK(job->isRunning()&&job->isCanceled());
+      job->finished();
+      TEST_CHECK(job->isFinished()&&job->isCanceled()&&!job->isRunning());
+      job->setState(multiJob::multiJob_CANCEL, false);
+      TEST_CHECK(job->isFinished()&&!job->isCanceled());
+   }
+
+   // user-013 callbacks still see every transition
+   void testStateCallbacks()
+   {
+      std::atomic<int> counter(0);
+      std::shared_ptr<test::CountJob> job = std::make_shared<test::CountJob>(&counter);
+      std::shared_ptr<RecordingCallback> callback = std::make_shared<RecordingCallback>();
+      job->setCallback(callback);
+      job->resetState(multiJob::multiJob_NONE);
+      job->ready();
+      job->start();
+      TEST_CHECK(counter == 1);
+      TEST_CHECK(callback->m_ready == 1);
+      TEST_CHECK(callback->m_started == 1);
+      TEST_CHECK(callback->m_finished == 1);
+      TEST_CHECK(callback->m_canceled == 0);
+
+      job->ready();
+      job->cancel();
+      TEST_CHECK(callback->m_canceled == 1);
+   }
+
+   // user-016 a throwing run is recorded on the job
+   void testStartStoresException()
+   {
+      std::shared_ptr<ThrowJob> job = std::make_shared<ThrowJob>();
+      job->start();
+      TEST_CHECK(job->isFinished());
+      TEST_CHECK(job->exception() != nullptr);
+   }
+
+   // user-016 a thread interrupt is not stored, it cancels the job and goes on
+   void testStartRethrowsInterrupt()
+   {
+      std::shared_ptr<InterruptJob> job = std::make_shared<InterruptJob>();
+      std::shared_ptr<multi::JobGroup> group = std::make_shared<multi::JobGroup>();
+      job->setGroup(group);
+      bool thrown = false;
+      try
+      {
+         job->start();
+      }
+      catch(const multi::Thread::Interrupt&)
+      {
+         thrown = true;
+      }
+      TEST_CHECK(thrown);
+      TEST_CHECK(job->isCanceled()&&!job->isFinished());
+      TEST_CHECK(job->exception() == nullptr);
+      TEST_CHECK(group->count() == 0);
+   }
+
+   // user-014 pooled jobs reuse their blocks
+   void testJobPool()
+   {
+      multi::JobPool<test::CountJob> pool;
+      pool.reserve(4);
+      TEST_CHECK(pool.freeCount() >= 4);
+      std::size_t freeCount = pool.freeCount();
+      {
+         std::shared_ptr<test::CountJob> job = pool.create();
+         TEST_CHECK(pool.freeCount() == freeCount-1);
+      }
+      TEST_CHECK(pool.freeCount() == freeCount);
+   }
+
+   // user-015 callables small enough are stored inline, larger ones on the heap
+   void testFunctionJob()
+   {
+      int value = 0;
+      std::shared_ptr<multiFunctionJob> small = std::make_shared<multiFunctionJob>([&value]{value += 1;});
+      small->start();
+      TEST_CHECK(value == 1);
+
+      std::string text(200, 'x');
+      char big[128] = {0};
+      std::shared_ptr<multiFunctionJob> large =
+         std::make_shared<multiFunctionJob>([&value, text, big]{value += int(text.size()) + big[0];});
+      large->start();
+      TEST_CHECK(value == 201);
+   }
+
+   // user-018 a group counts down as its jobs finish
+   void testJobGroup()
+   {
+      std::shared_ptr<multi::JobGroup> group = std::make_shared<multi::JobGroup>();
+      std::shared_ptr<test::CountJob> first  = std::make_shared<test::CountJob>();
+      std::shared_ptr<test::CountJob> second = std::make_shared<test::CountJob>();
+      first->setGroup(group);
+      second->setGroup(group);
+      TEST_CHECK(group->count() == 2);
+      first->start();
+      TEST_CHECK(group->count() == 1);
+      TEST_CHECK(!group->waitFor(1));
+      second->cancel();
+      second->finished();
+      TEST_CHECK(group->count() == 0);
+      TEST_CHECK(group->waitFor(1));
+      group->wait();
+
+      // a finished job is not counted again
+      first->setGroup(group);
+      TEST_CHECK(group->count() == 0);
+      TEST_CHECK(!first->group());
+      TEST_CHECK(group->waitFor(1));
+   }
+
+   // user-023 deadlines
+   void testDeadline()
+   {
+      std::shared_ptr<test::CountJob> job = std::make_shared<test::CountJob>();
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      TEST_CHECK(!job->hasDeadline());
+      TEST_CHECK(!job->isExpired(now));
+      job->setDeadline(now);
+      TEST_CHECK(job->hasDeadline());
+      TEST_CHECK(job->isExpired(now));
+      TEST_CHECK(!job->isExpired(now - std::chrono::seconds(1)));
+      job->clearDeadline();
+      TEST_CHECK(!job->isExpired(now));
+   }
+}
+
+void test::runJobTests()
+{
+   testStateTransitions();
+   testStateCallbacks();
+   testStartStoresException();
+   testStartRethrowsInterrupt();
+   testJobPool();
+   testFunctionJob();
+   testJobGroup();
+   testDeadline();
+}
@@ -0,0 +1,253 @@
+#include "testSupport.h"
+#include <multiJobRingQueue.h>
+#include <multiJobMultiThreadQueue.h>
+#include <multiJobGraph.h>
+#include <multiForkJoin.h>
+#include <thread>
+
+namespace{
+   class AddingCallback : public multiJobQueue::Callback
+   {
+   public:
+      AddingCallback():m_adding(0), m_added(0){}
+      virtual void adding(std::shared_ptr<multiJobQueue>, std::shared_ptr<multiJob>){++m_adding;}
+      virtual void added(std::shared_ptr<multiJobQueue>, std::shared_ptr<multiJob>){++m_added;}
+
+      std::atomic<int> m_adding;
+      std::atomic<int> m_added;
+   };
+
+   // user-007 FIFO order, fixed capacity and the full ring paths
+   void testRingBasics()
+   {
+      std::shared_ptr<multiJobRingQueue> q = std::make_shared<multiJobRingQueue>(3);
+      TEST_CHECK(q->capacity() == 4);
+      TEST_CHECK(q->isEmpty());
+
+      std::vector<std::shared_ptr<multiJob> > jobs;
+      for(int idx = 0;idx < 4;++idx)
+      {
+         jobs.push_back(std::make_shared<test::CountJob>());
+         TEST_CHECK(q->tryAdd(jobs.back()));
+      }
+      TEST_CHECK(q->size() == 4);
+      TEST_CHECK(!q->tryAdd(std::make_shared<test::CountJob>()));
+      TEST_CHECK(!q->addFor(std::make_shared<test::CountJob>(), 5));
+
+      jobs[1]->cancel();
+      TEST_CHECK(q->nextJob(false) == jobs[0]);
+      TEST_CHECK(q->nextJob(false) == jobs[2]);
+      TEST_CHECK(jobs[1]->isFinished());
+      TEST_CHECK(q->nextJob(false) == jobs[3]);
+      TEST_CHECK(!q->nextJob(false));
+
+      q->add(jobs[0]);
+      q->add(jobs[1]);
+      q->clear();
+      TEST_CHECK(q->isEmpty());
+   }
+
+   // user-007 blocked consumers wake for an add and for releaseBlock
+   void testRingBlocking()
+   {
+      std::shared_ptr<multiJobRingQueue> q = std::make_shared<multiJobRingQueue>(4);
+      std::shared_ptr<multiJob> job = std::make_shared<test::CountJob>();
+      std::shared_ptr<multiJob> result;
+      std::thread consumer([q, &result]{result = q->nextJob(true);});
+      multi::Thread::sleepInMilliSeconds(10);
+      q->add(job);
+      consumer.join();
+      TEST_CHECK(result == job);
+
+      std::thread released([q, &result]{result = q->nextJob(true);});
+      multi::Thread::sleepInMilliSeconds(10);
+      q->releaseBlock();
+      released.join();
+      TEST_CHECK(!result);
+   }
+
+   // user-007 several producers and consumers see every job once
+   void testRingConcurrent()
+   {
+      const int producers = 4;
+      const int jobsPerProducer = 2000;
+      std::shared_ptr<multiJobRingQueue> q = std::make_shared<multiJobRingQueue>(64);
+      std::atomic<int> counter(0);
+      std::atomic<int> consumed(0);
+      std::vector<std::thread> threads;
+      for(int idx = 0;idx < producers;++idx)
+      {
+         threads.push_back(std::thread([q, &counter]{
+            for(int jobIdx = 0;jobIdx < jobsPerProducer;++jobIdx)
+            {
+               q->add(std::make_shared<test::CountJob>(&counter));
+            }
+         }));
+      }
+      for(int idx = 0;idx < producers;++idx)
+      {
+         threads.push_back(std::thread([q, &consumed]{
+            while(consumed.load() < producers*jobsPerProducer)
+            {
+               std::shared_ptr<multiJob> job = q->nextJob(false);
+               if(job)
+               {
+                  job->start();
+                  ++consumed;
+               }
+               else
+               {
+                  std::this_thread::yield();
+               }
+            }
+         }));
+      }
+      for(std::size_t idx = 0;idx < threads.size();++idx) threads[idx].join();
+      TEST_CHECK(counter == producers*jobsPerProducer);
+      TEST_CHECK(q->isEmpty());
+   }
+
+   // user-018 workers park on the ring between jobs and stop when canceled
+   void testRingWorkers()
+   {
+      std::shared_ptr<multiJobRingQueue> q = std::make_shared<multiJobRingQueue>(16);
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>(q);
+      threadQueue->setIdlePolicy(multi::IdlePolicy(0, 0, false));
+      q->add(std::make_shared<test::CountJob>(&counter));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 1;}));
+      multi::Thread::sleepInMilliSeconds(20);
+      q->add(std::make_shared<test::CountJob>(&counter));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 2;}));
+      threadQueue->cancel();
+      TEST_CHECK(!threadQueue->isRunning());
+
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 3);
+      for(int round = 0;round < 3;++round)
+      {
+         for(int idx = 0;idx < 40;++idx) q->add(std::make_shared<test::CountJob>(&counter));
+         TEST_CHECK(pool->waitForIdle(5000));
+         multi::Thread::sleepInMilliSeconds(5);
+      }
+      TEST_CHECK(counter == 122);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-007 jobs added past the capacity are kept, never canceled
+   void testRingOverflow()
+   {
+      std::shared_ptr<multiJobRingQueue> q = std::make_shared<multiJobRingQueue>(2);
+      multiJob::List jobs;
+      for(int idx = 0;idx < 5;++idx) jobs.push_back(std::make_shared<test::CountJob>());
+      q->addAll(jobs, true);
+      TEST_CHECK(q->size() == 5);
+      TEST_CHECK(!q->isEmpty());
+      int count = 0;
+      for(multiJob::List::iterator iter = jobs.begin();iter != jobs.end();++iter)
+      {
+         if((*iter)->isCanceled()) ++count;
+      }
+      TEST_CHECK(count == 0);
+      count = 0;
+      while(q->nextJob(false)) ++count;
+      TEST_CHECK(count == 5);
+      TEST_CHECK(q->isEmpty());
+
+      q->addAll(jobs, true);
+      q->clear();
+      TEST_CHECK(q->isEmpty());
+      TEST_CHECK(q->size() == 0);
+
+      // a wide graph and a wide fork on a tiny ring finish
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJobGraph> graph = std::make_shared<multiJobGraph>();
+      multiJobGraph::Node root = graph->addFunction([]{});
+      for(int idx = 0;idx < 16;++idx)
+      {
+         graph->addEdge(root, graph->add(std::make_shared<test::CountJob>(&counter)));
+      }
+      TEST_CHECK(graph->run(q));
+      TEST_CHECK(graph->waitFor(5000));
+      TEST_CHECK(counter == 16);
+
+      std::shared_ptr<multi::JobGroup> group = std::make_shared<multi::JobGroup>();
+      std::shared_ptr<multiJob> parent = std::make_shared<multiFunctionJob>([&counter]{
+         multi::ForkJoin forkJoin;
+         for(int idx = 0;idx < 16;++idx) forkJoin.fork(std::make_shared<test::CountJob>(&counter));
+         forkJoin.join();
+      });
+      parent->setGroup(group);
+      q->add(parent);
+      TEST_CHECK(group->waitFor(5000));
+      TEST_CHECK(counter == 32);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-007 an add that does not fit leaves the job and the callback alone
+   void testFullAddUntouched()
+   {
+      std::shared_ptr<multiJobQueue> queues[] = {
+         std::make_shared<multiJobRingQueue>(2),
+         std::make_shared<multiJobQueue>()
+      };
+      queues[1]->setCapacity(2);
+      for(int idx = 0;idx < 2;++idx)
+      {
+         std::shared_ptr<multiJobQueue> q = queues[idx];
+         std::shared_ptr<AddingCallback> callback = std::make_shared<AddingCallback>();
+         q->setCallback(callback);
+         TEST_CHECK(q->tryAdd(std::make_shared<test::CountJob>()));
+         TEST_CHECK(q->tryAdd(std::make_shared<test::CountJob>()));
+         TEST_CHECK((callback->m_adding == 2)&&(callback->m_added == 2));
+
+         std::shared_ptr<multiJob> job = std::make_shared<test::CountJob>();
+         job->finished();
+         TEST_CHECK(!q->tryAdd(job));
+         TEST_CHECK(!q->addFor(job, 5));
+         TEST_CHECK(callback->m_adding == 2);
+         TEST_CHECK(job->isFinished()&&!job->isReady());
+
+         q->nextJob(false);
+         TEST_CHECK(q->tryAdd(job));
+         TEST_CHECK(job->isReady());
+         TEST_CHECK((callback->m_adding == 3)&&(callback->m_added == 3));
+
+         // a batch only announces and readies the jobs that get in
+         multiJob::List jobs;
+         for(int jobIdx = 0;jobIdx < 2;++jobIdx)
+         {
+            jobs.push_back(std::make_shared<test::CountJob>());
+            jobs.back()->finished();
+         }
+         std::atomic<std::size_t> added(0);
+         std::thread producer([q, &jobs, &added]{added = q->addAll(jobs);});
+         multi::Thread::sleepInMilliSeconds(10);
+         TEST_CHECK(callback->m_adding == 3);
+         TEST_CHECK(!jobs.front()->isReady()&&!jobs.back()->isReady());
+         q->nextJob(false);
+         TEST_CHECK(test::waitUntil([&jobs]{return jobs.front()->isReady();}));
+         multi::Thread::sleepInMilliSeconds(5);
+         TEST_CHECK(test::waitUntil([q, &jobs, &added]{
+            q->releaseProducers();
+            return added > 0;
+         }));
+         producer.join();
+         TEST_CHECK(added == 1);
+         TEST_CHECK(jobs.back()->isFinished()&&!jobs.back()->isReady());
+         TEST_CHECK((callback->m_adding == 4)&&(callback->m_added == 4));
+      }
+   }
+}
+
+void test::runRingQueueTests()
+{
+   testRingBasics();
+   testRingBlocking();
+   testRingConcurrent();
+   testRingWorkers();
+   testRingOverflow();
+   testFullAddUntouched();
+}
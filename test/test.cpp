@@ -1,6 +1,10 @@
 #include <iostream>
 #include <vector>
 #include <Thread.h>
+#include "testSupport.h"
+
+std::atomic<int> test::failureCount(0);
+
 int nThreads = 2;
 multi::Barrier barrierStart(nThreads);
 // one more for main thread
@@ -39,6 +43,12 @@ int main(int argc, char* argv[])
         barrierFinished.block();
 
         std::cout << "Redo:\n";
+        // the threads may still be leaving the barrier, a thread that is
+        // still running ignores start
+        for(auto& thread:threads)
+        {
+         thread->waitForCompletion();
+        }
         // you can also reset the barriers and run again
         barrierFinished.reset();
         barrierStart.reset();
@@ -47,5 +57,23 @@ int main(int argc, char* argv[])
          thread->start();
         }
         barrierFinished.block();
+
+        std::cout << "Jobs:\n";
+        test::runJobTests();
+        std::cout << "Job queue:\n";
+        test::runJobQueueTests();
+        std::cout << "Ring queue:\n";
+        test::runRingQueueTests();
+        std::cout << "Thread queues:\n";
+        test::runThreadQueueTests();
+        std::cout << "Composition:\n";
+        test::runComposeTests();
+        std::cout << "Timer:\n";
+        test::runTimerTests();
+        std::cout << "Allocations:\n";
+        test::runAllocationTests();
+
+        std::cout << test::failureCount << " failed checks\n";
+        return (test::failureCount > 0)?1:0;
 }
 
@@ -0,0 +1,83 @@
+#ifndef testSupport_HEADER
+#define testSupport_HEADER
+#include <multiJob.h>
+#include <Thread.h>
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+* Minimal checks shared by the test suites.  A failed check is reported with
+* its location and counted, the run continues so one report shows every
+* failure.  main returns non zero when any check failed.
+*/
+namespace test{
+   extern std::atomic<int> failureCount;
+
+   inline void fail(const char* file, int line, const char* expression)
+   {
+      ++failureCount;
+      std::cout << file << ":" << line << ": check failed: " << expression << "\n";
+   }
+
+   /**
+   * Polls the predicate until it holds or the time runs out
+   *
+   * @return the last value of the predicate
+   */
+   inline bool waitUntil(const std::function<bool()>& predicate,
+                         unsigned long long waitTimeMillis=5000)
+   {
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+
+                                                       std::chrono::milliseconds(waitTimeMillis);
+      while(!predicate())
+      {
+         if(std::chrono::steady_clock::now() >= deadline) return predicate();
+         multi::Thread::sleepInMilliSeconds(1);
+      }
+      return true;
+   }
+
+   /**
+   * A job that counts its runs and optionally records them in order
+   */
+   class CountJob : public multiJob
+   {
+   public:
+      CountJob(std::atomic<int>* counter=0, std::vector<int>* order=0, int tag=0, std::mutex* orderMutex=0)
+      :m_counter(counter), m_order(order), m_orderMutex(orderMutex), m_tag(tag){}
+
+   protected:
+      virtual void run()
+      {
+         if(m_counter) ++(*m_counter);
+         if(m_order)
+         {
+            if(m_orderMutex) m_orderMutex->lock();
+            m_order->push_back(m_tag);
+            if(m_orderMutex) m_orderMutex->unlock();
+         }
+      }
+
+      std::atomic<int>* m_counter;
+      std::vector<int>* m_order;
+      std::mutex*       m_orderMutex;
+      int               m_tag;
+   };
+
+   void runJobTests();
+   void runJobQueueTests();
+   void runRingQueueTests();
+   void runThreadQueueTests();
+   void runComposeTests();
+   void runTimerTests();
+   void runAllocationTests();
+}
+
+#define TEST_CHECK(expression) \
+   do{ if(!(expression)) test::fail(__FILE__, __LINE__, #expression); }while(0)
+
+#endif
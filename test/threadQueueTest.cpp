@@ -0,0 +1,261 @@
+#include "testSupport.h"
+#include <multiJobMultiThreadQueue.h>
+#include <multiJobQueue.h>
+#include <multiJobRingQueue.h>
+#include <thread>
+
+namespace{
+   class SleepJob : public multiJob
+   {
+   public:
+      SleepJob(std::atomic<int>* counter, unsigned long long millis):m_counter(counter), m_millis(millis){}
+   protected:
+      virtual void run()
+      {
+         multi::Thread::sleepInMilliSeconds(m_millis);
+         ++(*m_counter);
+      }
+      std::atomic<int>*  m_counter;
+      unsigned long long m_millis;
+   };
+
+   /**
+   * Pushes its children on the local deque of the thread running it
+   */
+   class SpawnJob : public multiJob
+   {
+   public:
+      SpawnJob(std::atomic<int>* counter, int children):m_counter(counter), m_children(children){}
+   protected:
+      virtual void run()
+      {
+         multiJobThreadQueue* threadQueue = multiJobThreadQueue::currentThreadQueue();
+         for(int idx = 0;idx < m_children;++idx)
+         {
+            std::shared_ptr<multiJob> child = std::make_shared<test::CountJob>(m_counter);
+            if(!threadQueue||!threadQueue->pushLocal(child)) child->start();
+         }
+      }
+      std::atomic<int>* m_counter;
+      int               m_children;
+   };
+
+   class GateJob : public multiJob
+   {
+   public:
+      GateJob(std::atomic<bool>* open):m_open(open){}
+   protected:
+      virtual void run()
+      {
+         while(!m_open->load()) multi::Thread::sleepInMilliSeconds(1);
+      }
+      std::atomic<bool>* m_open;
+   };
+
+   /**
+   * Asks the thread queue for its current job when the job is canceled.  A
+   * canceled job that is finished is reported as canceled again.
+   */
+   class CurrentJobCallback : public multiJobCallback
+   {
+   public:
+      CurrentJobCallback(multiJobThreadQueue* threadQueue, std::atomic<int>* counter)
+      :m_threadQueue(threadQueue), m_counter(counter){}
+      virtual void canceled(std::shared_ptr<multiJob>)
+      {
+         m_threadQueue->currentJob();
+         ++(*m_counter);
+      }
+      multiJobThreadQueue* m_threadQueue;
+      std::atomic<int>*    m_counter;
+   };
+
+   // a single worker runs what is added, also after it went idle
+   void testThreadQueue()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>(q);
+      std::atomic<int> counter(0);
+      for(int idx = 0;idx < 10;++idx) q->add(std::make_shared<test::CountJob>(&counter));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 10;}));
+      TEST_CHECK(threadQueue->isEmpty());
+      multi::Thread::sleepInMilliSeconds(20);
+      q->add(std::make_shared<test::CountJob>(&counter));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 11;}));
+      threadQueue->cancel();
+      TEST_CHECK(!threadQueue->isRunning());
+   }
+
+   // user-002 children pushed locally are run or stolen by the peers
+   void testWorkStealing()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 4);
+      pool->setWorkStealing(true);
+      TEST_CHECK(pool->isWorkStealing());
+      std::atomic<int> counter(0);
+      for(int idx = 0;idx < 20;++idx) q->add(std::make_shared<SpawnJob>(&counter, 50));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 1000;}));
+      pool->waitForIdle();
+      TEST_CHECK(counter == 1000);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-002 a local push wakes a single parked peer and no producer
+   void testLocalPushWakesPeer()
+   {
+      std::shared_ptr<multiJobQueue> queues[] = {
+         std::make_shared<multiJobQueue>(),
+         std::make_shared<multiJobRingQueue>(2)
+      };
+      queues[0]->setCapacity(2);
+      for(int idx = 0;idx < 2;++idx)
+      {
+         std::shared_ptr<multiJobQueue> q = queues[idx];
+         std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+         pool->setWorkStealing(true);
+         pool->setIdlePolicy(multi::IdlePolicy(0, 0, false));
+         std::atomic<int> counter(0);
+         std::atomic<bool> stolen(false);
+         multiJobMultiThreadQueue* poolPtr = pool.get();
+         multi::Thread::sleepInMilliSeconds(10);
+
+         // the parent waits for its child so only a woken peer can run it
+         q->add(std::make_shared<multiFunctionJob>([poolPtr, &counter, &stolen]{
+            poolPtr->add(std::make_shared<test::CountJob>(&counter));
+            stolen = test::waitUntil([&counter]{return counter == 1;}, 2000);
+         }));
+         TEST_CHECK(pool->waitForIdle(5000));
+         TEST_CHECK(stolen);
+         TEST_CHECK(counter == 1);
+         pool->cancel();
+         pool->waitForCompletion();
+      }
+   }
+
+   // user-005 batches and user-009 idle policies still run everything
+   void testBatchAndIdlePolicy()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 3);
+      pool->setBatchSize(8);
+      TEST_CHECK(pool->batchSize() == 8);
+      pool->setIdlePolicy(multi::IdlePolicy(200, 200, true));
+      TEST_CHECK(pool->idlePolicy().spinMicros() == 200);
+      std::atomic<int> counter(0);
+      for(int round = 0;round < 5;++round)
+      {
+         for(int idx = 0;idx < 100;++idx) q->add(std::make_shared<test::CountJob>(&counter));
+         TEST_CHECK(pool->waitForIdle(5000));
+         multi::Thread::sleepInMilliSeconds(1);
+      }
+      TEST_CHECK(counter == 500);
+
+      pool->setIdlePolicy(multi::IdlePolicy(0, 0, false));
+      q->add(std::make_shared<test::CountJob>(&counter));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 501;}));
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-005 a job canceled in a batch is finished outside the thread mutex
+   void testCanceledInBatch()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>();
+      threadQueue->setBatchSize(4);
+      std::atomic<bool> open(false);
+      std::atomic<int> counter(0);
+      std::shared_ptr<multiJob> canceled = std::make_shared<test::CountJob>();
+      canceled->setCallback(std::make_shared<CurrentJobCallback>(threadQueue.get(), &counter));
+      q->add(std::make_shared<GateJob>(&open));
+      q->add(canceled);
+      threadQueue->setJobQueue(q);
+      TEST_CHECK(test::waitUntil([q]{return q->isEmpty();}));
+      canceled->cancel();
+      open = true;
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 2;}));
+      TEST_CHECK(canceled->isFinished());
+      threadQueue->cancel();
+   }
+
+   // user-009 a spinning worker polls the hint and leaves releaseBlock alone
+   void testSpinKeepsRelease()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      TEST_CHECK(q->isEmptyHint());
+      q->add(std::make_shared<test::CountJob>());
+      TEST_CHECK(!q->isEmptyHint());
+      q->nextJob(false);
+      TEST_CHECK(q->isEmptyHint());
+
+      std::shared_ptr<multiJobThreadQueue> threadQueue = std::make_shared<multiJobThreadQueue>();
+      threadQueue->setIdlePolicy(multi::IdlePolicy(1000000, 1000000, false));
+      threadQueue->setJobQueue(q);
+      multi::Thread::sleepInMilliSeconds(20);
+      q->releaseBlock();
+      multi::Thread::sleepInMilliSeconds(5);
+      std::atomic<bool> done(false);
+      std::thread consumer([q, &done]{
+         q->nextJob(true);
+         done = true;
+      });
+      TEST_CHECK(test::waitUntil([&done]{return done.load();}, 500));
+      q->releaseBlock();
+      consumer.join();
+      threadQueue->cancel();
+   }
+
+   // user-010 the pool grows under load and shrinks back when idle
+   void testAutoScaling()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 1);
+      pool->setAutoScaling(multi::ScalingPolicy(1, 4, 1, 1, 50, 5));
+      TEST_CHECK(pool->isAutoScaling());
+      std::atomic<int> counter(0);
+      for(int idx = 0;idx < 40;++idx) q->add(std::make_shared<SleepJob>(&counter, 5));
+      TEST_CHECK(test::waitUntil([pool]{return pool->getNumberOfThreads() > 1;}));
+      TEST_CHECK(test::waitUntil([&counter]{return counter == 40;}));
+      TEST_CHECK(test::waitUntil([pool]{return pool->getNumberOfThreads() == 1;}));
+      pool->disableAutoScaling();
+      TEST_CHECK(!pool->isAutoScaling());
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+
+   // user-011 pinned threads still run the jobs
+   void testPlacement()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      std::atomic<int> counter(0);
+      multiJobMultiThreadQueue::PlacementMode modes[] = {
+         multiJobMultiThreadQueue::COMPACT_PLACEMENT,
+         multiJobMultiThreadQueue::SCATTER_PLACEMENT,
+         multiJobMultiThreadQueue::NO_PLACEMENT
+      };
+      for(int idx = 0;idx < 3;++idx)
+      {
+         pool->setPlacement(modes[idx]);
+         TEST_CHECK(pool->placementMode() == modes[idx]);
+         q->add(std::make_shared<test::CountJob>(&counter));
+         TEST_CHECK(test::waitUntil([&counter, idx]{return counter == idx+1;}));
+      }
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+}
+
+void test::runThreadQueueTests()
+{
+   testThreadQueue();
+   testWorkStealing();
+   testLocalPushWakesPeer();
+   testBatchAndIdlePolicy();
+   testCanceledInBatch();
+   testSpinKeepsRelease();
+   testAutoScaling();
+   testPlacement();
+}
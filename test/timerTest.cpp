@@ -0,0 +1,60 @@
+#include "testSupport.h"
+#include <multiJobQueue.h>
+#include <multiJobMultiThreadQueue.h>
+#include <multiJobTimer.h>
+
+namespace{
+   // user-021 delayed jobs reach the queue once they are due, in due order
+   void testAddAfter()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJob> later = std::make_shared<test::CountJob>();
+      std::shared_ptr<multiJob> sooner = std::make_shared<test::CountJob>();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      q->addAfter(later, std::chrono::milliseconds(60));
+      q->addAfter(sooner, std::chrono::milliseconds(20));
+      TEST_CHECK(q->isEmpty());
+      std::shared_ptr<multiJob> first = q->nextJob(true);
+      TEST_CHECK(first == sooner);
+      TEST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+      TEST_CHECK(q->nextJob(true) == later);
+      TEST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(60));
+
+      // a canceled job is not delivered
+      std::shared_ptr<multiJob> canceled = std::make_shared<test::CountJob>();
+      q->addAfter(canceled, std::chrono::milliseconds(5));
+      canceled->cancel();
+      multi::Thread::sleepInMilliSeconds(50);
+      TEST_CHECK(!q->nextJob(false));
+   }
+
+   // user-022 periodic jobs repeat until canceled
+   void testPeriodic()
+   {
+      std::shared_ptr<multiJobQueue> q = std::make_shared<multiJobQueue>();
+      std::shared_ptr<multiJobMultiThreadQueue> pool = std::make_shared<multiJobMultiThreadQueue>(q, 2);
+      std::atomic<int> rate(0);
+      std::atomic<int> delay(0);
+      std::shared_ptr<multiPeriodicJob> fixedRate =
+         q->addPeriodicFunction([&rate]{++rate;}, std::chrono::milliseconds(5));
+      std::shared_ptr<multiPeriodicJob> fixedDelay =
+         q->addPeriodicFunction([&delay]{++delay;}, std::chrono::milliseconds(5), multiPeriodicJob::FIXED_DELAY);
+      TEST_CHECK(test::waitUntil([&rate, &delay]{return (rate >= 5)&&(delay >= 5);}));
+      fixedRate->cancel();
+      fixedDelay->cancel();
+      TEST_CHECK(fixedRate->isStopped());
+      multi::Thread::sleepInMilliSeconds(30);
+      int stopped = rate;
+      multi::Thread::sleepInMilliSeconds(30);
+      TEST_CHECK(rate == stopped);
+      TEST_CHECK(fixedRate->runCount() >= 5);
+      pool->cancel();
+      pool->waitForCompletion();
+   }
+}
+
+void test::runTimerTests()
+{
+   testAddAfter();
+   testPeriodic();
+}